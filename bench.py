@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+# bench.py - Simulator throughput benchmark. Runs ./csim over long.trace
+#     and larger synthetic traces from ./synthgen across a matrix of cache
+#     geometries, reports Maccesses/sec, ns/access and peak RSS for each
+#     run, and compares them against a stored baseline to flag
+#     regressions. Run through "make bench"; "make bench-baseline"
+#     records the current numbers as the new baseline.
+#
+import os
+import sys
+import time
+import optparse
+import subprocess
+
+# Synthetic traces live here; they are regenerated only when missing
+TRACE_DIR = "bench-traces"
+
+BASELINE = "bench-baseline.txt"
+
+# Each measurement repeats runs until they add up to MIN_SECONDS of CPU
+MIN_SECONDS = 1.0
+MAX_RUNS = 50
+
+#
+# Traces: name -> (file, synthgen arguments or None for a checked-in trace)
+#
+TRACES = [
+    ("long", "long.trace", None),
+    ("mix-bin", TRACE_DIR + "/mix.bin",
+     "-n 10M -p zipf:3,seq,chase,tiles:2 -w 64Mi -s 1 -f bin"),
+    ("uniform-txt", TRACE_DIR + "/uniform.txt",
+     "-n 2M -p uniform -w 16Mi -s 2 -f text"),
+]
+
+#
+# Geometries: name -> (s, E, b)
+#
+GEOMETRIES = [
+    ("dm-small",  (5, 1, 5)),
+    ("dm-large",  (14, 1, 6)),
+    ("4way",      (8, 4, 6)),
+    ("8way",      (6, 8, 6)),
+    ("16way",     (4, 16, 6)),
+    ("16way-bigs", (12, 16, 6)),
+    ("fully-assoc", (0, 64, 6)),
+]
+
+#
+# countAccesses - number of data accesses in a trace (M counts twice)
+#
+def countAccesses(path):
+    if path.endswith(".bin"):
+        count = 0
+        with open(path, "rb") as f:
+            f.read(8)
+            while True:
+                chunk = f.read(8 << 16)
+                if not chunk:
+                    break
+                # The top byte of each record holds the operation
+                top = chunk[7::8]
+                count += len(top) + sum(top.count(bytes([v])) for v in range(0xc0, 0x100))
+        return count
+    count = 0
+    with open(path) as f:
+        for line in f:
+            if line[:3] in (" L ", " S "):
+                count += 1
+            elif line[:3] == " M ":
+                count += 2
+    return count
+
+#
+# peakRss - high-water RSS in KB of a running process, or 0 once it exited
+#
+def peakRss(pid):
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except (IOError, OSError, ValueError):
+        pass
+    return 0
+
+#
+# runOnce - run csim once, return (CPU seconds, peak RSS in KB). The
+#     rusage maxrss of a child includes the Python image it was forked
+#     from, so the peak is sampled from /proc instead while csim runs.
+#
+def runOnce(path, geometry):
+    s, E, b = geometry
+    cmd = ["./csim", "-s", str(s), "-E", str(E), "-b", str(b), "-t", path]
+    rss = 0
+    with open(os.devnull, "w") as devnull:
+        p = subprocess.Popen(cmd, stdout=devnull)
+        while True:
+            rss = max(rss, peakRss(p.pid))
+            pid, status, usage = os.wait4(p.pid, os.WNOHANG)
+            if pid != 0:
+                break
+            time.sleep(0.005)
+    p.returncode = os.waitstatus_to_exitcode(status)
+    if p.returncode != 0:
+        print("Error: %s exited with status %d" % (" ".join(cmd), p.returncode))
+        sys.exit(1)
+    return usage.ru_utime + usage.ru_stime, rss or usage.ru_maxrss
+
+#
+# readBaseline - {(trace, geometry): (ns/access, rss KB)}
+#
+def readBaseline():
+    baseline = {}
+    if not os.path.exists(BASELINE):
+        return baseline
+    with open(BASELINE) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or fields[0].startswith("#"):
+                continue
+            baseline[(fields[0], fields[1])] = (float(fields[2]), int(fields[3]))
+    return baseline
+
+#
+# main - Main function
+#
+def main():
+    p = optparse.OptionParser()
+    p.add_option("-r", type="int", dest="repeats", default=5,
+                 help="minimum runs per trace and geometry, the fastest counts")
+    p.add_option("-t", type="float", dest="tolerance", default=0.20,
+                 help="allowed slowdown over the baseline (default 0.20)")
+    p.add_option("--save", action="store_true", dest="save",
+                 help="record the results as the new baseline")
+    opts, args = p.parse_args()
+
+    if not os.path.isdir(TRACE_DIR):
+        os.mkdir(TRACE_DIR)
+    for name, path, gen in TRACES:
+        if gen is not None and not os.path.exists(path):
+            print("Generating %s" % path)
+            subprocess.check_call(["./synthgen"] + gen.split() + ["-o", path])
+
+    baseline = readBaseline()
+    results = []
+    regressions = 0
+
+    print("%-12s %-12s %12s %10s %10s %10s  %s" %
+          ("trace", "geometry", "accesses", "Macc/s", "ns/acc", "RSS KB", "vs baseline"))
+    for name, path, gen in TRACES:
+        accesses = countAccesses(path)
+        for gname, geometry in GEOMETRIES:
+            # Short runs are noisy: keep going until a second of CPU time
+            runs = []
+            while len(runs) < opts.repeats or \
+                  (sum(r[0] for r in runs) < MIN_SECONDS and len(runs) < MAX_RUNS):
+                runs.append(runOnce(path, geometry))
+            secs = min(r[0] for r in runs)
+            rss = max(r[1] for r in runs)
+            ns = secs * 1e9 / accesses
+            results.append((name, gname, ns, rss))
+
+            verdict = "no baseline"
+            if (name, gname) in baseline:
+                base_ns, base_rss = baseline[(name, gname)]
+                verdict = "%+.1f%%" % ((ns / base_ns - 1) * 100)
+                if ns > base_ns * (1 + opts.tolerance):
+                    verdict += " REGRESSION (time)"
+                    regressions += 1
+                if rss > base_rss * 1.25 + 1024:
+                    verdict += " REGRESSION (RSS)"
+                    regressions += 1
+            print("%-12s %-12s %12d %10.2f %10.2f %10d  %s" %
+                  (name, gname, accesses, accesses / secs / 1e6, ns, rss, verdict))
+
+    if opts.save:
+        with open(BASELINE, "w") as f:
+            f.write("# Simulator throughput baseline written by ./bench.py --save\n")
+            f.write("# Machine-specific: re-record after changing hardware.\n")
+            f.write("# trace geometry ns/access peak-RSS-KB\n")
+            for name, gname, ns, rss in results:
+                f.write("%s %s %.2f %d\n" % (name, gname, ns, rss))
+        print("\nBaseline saved to %s" % BASELINE)
+        return
+
+    if regressions:
+        print("\n%d regression(s) beyond %.0f%% of %s" %
+              (regressions, opts.tolerance * 100, BASELINE))
+        sys.exit(1)
+    print("\nNo regressions")
+
+# execute main only if called as a script
+if __name__ == "__main__":
+    main()
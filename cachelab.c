@@ -1,14 +1,21 @@
 /*
  * cachelab.c - Cache Lab helper functions
  */
+#define _POSIX_C_SOURCE 200809L /* for mkdtemp and struct timespec */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
 #include "cachelab.h"
 #include <time.h>
 
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
+inplace_func_t inplace_list[MAX_TRANS_FUNCS];
+int inplace_counter = 0;
 
 /* 
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
@@ -81,3 +88,79 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+/*
+ * registerInplaceFunction - Add the given in-place transpose of a square
+ *     matrix into its own list of functions to be tested
+ */
+void registerInplaceFunction(void (*trans)(int N, int[N][N]), char* desc)
+{
+    inplace_list[inplace_counter].func_ptr = trans;
+    inplace_list[inplace_counter].description = desc;
+    inplace_list[inplace_counter].correct = 0;
+    inplace_list[inplace_counter].num_hits = 0;
+    inplace_list[inplace_counter].num_misses = 0;
+    inplace_list[inplace_counter].num_evictions = 0;
+    inplace_counter++;
+}
+
+/*
+ * elapsed - Seconds between two clock_gettime readings
+ */
+double elapsed(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * quotePath - Quote path in single quotes for the shell, so spaces and
+ *     metacharacters in the directory a driver runs in stay literal
+ */
+void quotePath(char *quoted, const char *path)
+{
+    *quoted++ = '\'';
+    for (; *path; path++) {
+        if (*path == '\'') {
+            strcpy(quoted, "'\\''");
+            quoted += 4;
+        } else {
+            *quoted++ = *path;
+        }
+    }
+    *quoted++ = '\'';
+    *quoted = '\0';
+}
+
+/*
+ * makeScratchDir - Create a private <tool>.XXXXXX directory in the
+ *     current one and store its name in dir; exits if that fails
+ */
+void makeScratchDir(char *dir, const char *tool)
+{
+    sprintf(dir, "%s.XXXXXX", tool);
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+}
+
+/*
+ * removeDir - Delete a scratch directory and everything in it
+ */
+void removeDir(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *entry;
+    DIR *dp = opendir(dir);
+
+    if (dp == NULL)
+        return;
+    while ((entry = readdir(dp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dp);
+    rmdir(dir);
+}
@@ -5,6 +5,8 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stddef.h>
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func{
@@ -16,6 +18,60 @@ typedef struct trans_func{
   unsigned int num_evictions;
 } trans_func_t;
 
+/* A transpose of a square matrix over itself */
+typedef struct inplace_func{
+  void (*func_ptr)(int N,int[N][N]);
+  char* description;
+  char correct;
+  unsigned int num_hits;
+  unsigned int num_misses;
+  unsigned int num_evictions;
+} inplace_func_t;
+
+/*
+ * Packed binary traces, written by synthgen -f bin and read by csim: the
+ * magic string, then one native-endian 64-bit record per access with the
+ * address in the low 56 bits, the size in the next 4 bits and the index
+ * of the operation in TRACE_BIN_OPS in the top 2 bits.
+ */
+#define TRACE_BIN_MAGIC "CLTRACE1"
+#define TRACE_BIN_MAGIC_LEN 8
+#define TRACE_BIN_OPS "ILSM"
+#define TRACE_BIN_ADDR_MASK ((1ULL << 56) - 1)
+#define TRACE_BIN_MAX_SIZE 15
+#define TRACE_BIN_RECORD(opindex, addr, size) \
+  (((unsigned long long) (opindex) << 62) | \
+   ((unsigned long long) (size) << 56) | ((addr) & TRACE_BIN_ADDR_MASK))
+#define TRACE_BIN_OP(rec) (TRACE_BIN_OPS[(rec) >> 62])
+#define TRACE_BIN_SIZE(rec) ((int) (((rec) >> 56) & 0xf))
+#define TRACE_BIN_ADDR(rec) ((rec) & TRACE_BIN_ADDR_MASK)
+
+/* Maximum tile width of the parameterized blocked transpose */
+#define MAX_TILE_WIDTH 32
+
+/* One member of the parameterized blocked transpose family */
+typedef struct trans_config{
+  int bw;           /* tile width, in columns of A (at most MAX_TILE_WIDTH) */
+  int bh;           /* tile height, in rows of A */
+  char defer_diag;  /* copy diagonal tiles first, then transpose them in B */
+  char swap64;      /* 4+4 quadrant swap through B for full 8x8 tiles */
+} trans_config_t;
+
+/*
+ * TRANS_LOAD/TRANS_STORE - Matrix accesses in trans_blocked() go through
+ *     these so that tune-trans can record their addresses without
+ *     valgrind. Building with -DTRANS_TRACE routes every access through
+ *     traceAccess(), which the tracing program must define.
+ */
+#ifdef TRANS_TRACE
+void traceAccess(char op, void *addr, int size);
+#define TRANS_LOAD(x) (traceAccess('L', &(x), sizeof(x)), (x))
+#define TRANS_STORE(x, v) (traceAccess('S', &(x), sizeof(x)), (x) = (v))
+#else
+#define TRANS_LOAD(x) (x)
+#define TRANS_STORE(x, v) ((x) = (v))
+#endif
+
 /* 
  * printSummary - This function provides a standard way for your cache
  * simulator * to display its final hit and miss statistics
@@ -34,4 +90,48 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(
     void (*trans)(int M,int N,int[N][M],int[M][N]), char* desc);
 
+/* Add the given in-place function to the in-place function list */
+void registerInplaceFunction(void (*trans)(int N,int[N][N]), char* desc);
+
+/* Helpers shared by the test-trans, tune-trans and ptrans-bench drivers */
+struct timespec;
+
+/* Seconds between two clock_gettime readings */
+double elapsed(const struct timespec *start, const struct timespec *end);
+
+/* Single-quote path for the shell; quoted needs 4 * strlen(path) + 3 bytes */
+void quotePath(char *quoted, const char *path);
+
+/* Create a private <tool>.XXXXXX scratch directory, at most 32 bytes of name */
+void makeScratchDir(char *dir, const char *tool);
+
+/* Delete a scratch directory and the files in it */
+void removeDir(const char *dir);
+
+/* Parameterized blocked transpose in trans.c */
+void trans_blocked(int M, int N, int A[N][M], int B[M][N]);
+
+/* Vector transposes in trans-simd.c; trans_simd() dispatches on CPUID */
+void initStrided();
+void transStrided(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb);
+void trans_simd(int M, int N, int A[N][M], int B[M][N]);
+void trans_sse2(int M, int N, int A[N][M], int B[M][N]);
+void trans_avx2(int M, int N, int A[N][M], int B[M][N]);
+
+/* Register the SIMD kernels supported on this machine */
+void registerSimdFunctions();
+
+/* Thread pool behind the parallel transpose in ptrans.c */
+typedef struct ptrans_pool ptrans_pool_t;
+
+/* Start and stop a pool of transpose workers */
+ptrans_pool_t *ptransCreate(int nthreads);
+void ptransDestroy(ptrans_pool_t *pool);
+
+/* Output matrix for a rows x cols transpose, first-touched by its workers */
+int *ptransAlloc(ptrans_pool_t *pool, int rows, int cols);
+
+/* B = A^T for a rows x cols A; returns the number of stolen strips */
+long ptrans(ptrans_pool_t *pool, int rows, int cols, const int *A, int *B);
+
 #endif /* CACHELAB_TOOLS_H */
@@ -1,9 +1,14 @@
+#define _POSIX_C_SOURCE 200809L // for mmap
 #include "cachelab.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 /**
  *  
  *   Jacob Lovingood, Spencer Withee
@@ -15,6 +20,35 @@
 // Verbose flag used for verbose output.
 int verbose = 0;
 
+// Matrices a conflict analysis attributes accesses to: A, B, or neither.
+#define MATRICES 3
+const char *matrix_names[MATRICES] = {"A", "B", "other"};
+
+/** Layout holds the matrix layout and the results of a conflict analysis (-L).
+ * A Base/B Base: Addresses of A and B, read from a tracegen marker file.
+ * M/N: Matrix size. A is N rows of M ints and B is M rows of N ints, as in trans.c.
+ * A Misses/B Misses: Number of misses on each element of A and B.
+ * Conflicts: For each set, misses, evictions, and a MATRICES x MATRICES table of how often a miss in one matrix evicted a block of another.
+ * Log: One CSV line per miss.
+ */
+typedef struct Layout
+{
+    unsigned long a_base;
+    unsigned long b_base;
+    int M;
+    int N;
+    unsigned int *a_misses;
+    unsigned int *b_misses;
+    unsigned long *conflicts;
+    FILE *log;
+}Layout;
+
+// Conflict analysis state, NULL unless -L was given.
+Layout *layout = NULL;
+
+// Columns of Layout.conflicts per set.
+#define CONFLICT_COLUMNS (2 + MATRICES * MATRICES)
+
 /** Cache holds different variables for abstraction of a cache.
  * Associativity: Number of lines per set (slots).
  * Index Bits: Equalivalent to the s in 2^s for the number of sets.
@@ -22,6 +56,13 @@ int verbose = 0;
  * Block Size: The number 2^b where b is the number of bits per block.
  * Sets: The number 2^s which is the number of sets in the cache.
  * Tags is a ref to number of tags.
+ * Skewed: Set by -K. Way w of the cache is indexed with its own hash of the block number, tags[set][w] holds whole block numbers, and lines are replaced by the LRU timestamps in Stamps.
+ * Clock: Time of the last access, for the timestamps.
+ * Victims: The victim buffer added by -V, or NULL.
+ * Victim Hits/Swaps: Accesses that hit in the victim buffer, and how many of those had to move a line of the cache into the buffer in exchange.
+ * Mmu: The TLB front end added by --page-size, --l1-tlb or --l2-tlb, or NULL.
+ * Timing: The timing model added by --timing or any latency option, or NULL.
+ * Mapping/Mapping Size: The state file the tags and stamps point into after --load-state, or NULL when they were allocated.
  */
 typedef struct Cache
 {
@@ -31,129 +72,1382 @@ typedef struct Cache
     int block_bits;
     int block_size;
     unsigned long int **tags;
+    int skewed;
+    unsigned long int **stamps;
+    unsigned long int clock;
+    struct Victims *victims;
+    unsigned long int victim_hits;
+    unsigned long int swaps;
+    struct Mmu *mmu;
+    struct Timing *timing;
+    void *mapping;
+    size_t mapping_size;
 }Cache;
 
+// First bytes of a file written by --save-state.
+#define STATE_MAGIC "CSIMST01"
+
+/** StateHeader starts a cache state file. It is followed by the tags, sets rows of E lines each in LRU order (MRU first), for a skewed cache by the timestamps in the same layout, and with -V by the victim buffer's entries.
+ * Geometry: s, E, b and whether the cache is skewed. A state loads only into the same cache.
+ * Clock: Timestamp of the last access of a skewed cache.
+ * Hits/Misses/Evictions: Totals of every run that led to this state.
+ * Reserved: The victim buffer's size (0 without -V) and how many of its entries are valid.
+ */
+typedef struct StateHeader
+{
+    char magic[8];
+    int32_t index_bits;
+    int32_t associativity;
+    int32_t block_bits;
+    int32_t skewed;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t reserved[2];
+}StateHeader;
+
+// The on-disk format: 72 bytes of header with no padding, then the lines.
+_Static_assert(sizeof(StateHeader) == 72, "state file header must stay 72 bytes");
+
+/** Victims is a small fully associative buffer for blocks evicted from the cache (-V).
+ * Size: Number of entries.
+ * Used: Number of valid entries.
+ * Blocks: Block numbers of the entries, the MRU one first.
+ */
+typedef struct Victims
+{
+    int size;
+    int used;
+    unsigned long int *blocks;
+}Victims;
+
+/** Tlb is one set-associative TLB level.
+ * Sets/Ways: Geometry, the number of entries is sets * ways. A level with no sets is absent.
+ * Fifo: Replace the oldest entry instead of the least recently used one.
+ * Entries: Virtual page numbers, sets rows of ways entries, the MRU (or newest) first and -1 when invalid.
+ */
+typedef struct Tlb
+{
+    int sets;
+    int ways;
+    int fifo;
+    unsigned long int *entries;
+}Tlb;
+
+/** Mmu holds the TLB front end. Data accesses are translated before they reach the cache, and a miss in both TLBs walks the page table with loads that go through the data cache.
+ * Page Bits: 12 for 4K pages, walked in 4 levels, or 21 for 2M pages, walked in 3.
+ * L1/L2: The TLB levels.
+ * L1 Hits/L2 Hits/Misses: Translations by outcome.
+ * Walk Hits/Misses/Evictions: Cache results of the page walk loads, kept apart from the data counts.
+ * Walking: Set while the walk loads access the cache, so the conflict analysis leaves them out.
+ */
+typedef struct Mmu
+{
+    int page_bits;
+    Tlb l1;
+    Tlb l2;
+    unsigned long int l1_hits;
+    unsigned long int l2_hits;
+    unsigned long int misses;
+    unsigned long int walk_hits;
+    unsigned long int walk_misses;
+    unsigned long int walk_evictions;
+    int walking;
+}Mmu;
+
+/** Timing estimates cycles from the trace order. Up to Width accesses issue per cycle, in order. A hit completes after the latency of the level it hit in, and a miss holds one of the MSHRs until memory returns the block. Later accesses to a block that is still on its way wait for that MSHR instead of taking another one. When every MSHR is busy, issue stalls until the first one frees up. Translation comes first: an L2 TLB hit adds Tlb Latency, and a page walk adds the latency of each of its loads in turn.
+ * Hit/Victim/Miss/Tlb Latency: Cycles for a cache hit, a victim buffer hit, a miss to memory and an L2 TLB hit.
+ * Mshrs/Mshr Block/Mshr Ready: Number of MSHRs, and the block each one fetches and the cycle it arrives.
+ * Width: Accesses issued per cycle.
+ * Cycle/Slot: Issue cycle of the last access, and how many accesses issued in that cycle.
+ * Pending: Arrival cycle of the block the last access touched, if it was still in flight.
+ * Finish: Latest completion cycle so far.
+ * Accesses/Latency: Timed data accesses and the sum of their latencies, from issue to completion.
+ * Miss Cycles/Busy Cycles/Busy Until: Cycles MSHRs were held in total, cycles at least one was held, and the end of the last such stretch, for the memory-level parallelism.
+ * Merges/Stalls: Accesses that waited on another access's MSHR, and cycles issue stalled with every MSHR busy.
+ */
+typedef struct Timing
+{
+    int hit_latency;
+    int victim_latency;
+    int miss_latency;
+    int tlb_latency;
+    int mshrs;
+    unsigned long int *mshr_block;
+    unsigned long int *mshr_ready;
+    int width;
+    unsigned long int cycle;
+    int slot;
+    unsigned long int pending;
+    unsigned long int finish;
+    unsigned long int accesses;
+    unsigned long int latency;
+    unsigned long int miss_cycles;
+    unsigned long int busy_cycles;
+    unsigned long int busy_until;
+    unsigned long int merges;
+    unsigned long int stalls;
+}Timing;
+
+// Page table entries live above the 56 address bits of any trace, one 2^40 byte region per level.
+// Walks translate 48-bit virtual addresses, so even the last level's entries (2^36 of them) fit in a region.
+#define PAGE_TABLE_BASE (1UL << 56)
+#define PAGE_TABLE_LEVEL_BYTES (1UL << 40)
+#define VIRTUAL_ADDRESS_BITS 48
+
+// Trace records are read and filtered this many at a time.
+#define BATCH_SIZE 4096
+
+/**
+ * One trace record, as parsed from a text trace or unpacked from a binary one.
+*/
+typedef struct Record
+{
+    unsigned long address;
+    int size;
+    char operation;
+}Record;
+
+/**
+ * A run of records that all touch the same block (and the same page when there is a TLB), found by the coalescing filter.
+ * Only the first data access of a run (records[first]) is simulated. Every later access, including the second half of a modify, hits the block that access just made MRU, so it is a guaranteed hit that leaves the LRU order alone.
+ * First/Last: Indexes of the first and last record of the run in the batch. Instruction fetches in between are skipped.
+ * Hits: Number of guaranteed hits after the first access.
+*/
+typedef struct Run
+{
+    int first;
+    int last;
+    int hits;
+}Run;
+
+/**
+ * Print for help calling and testing the Cache.
+*/
+void printUsage()
+{
+    printf("Usage: ./csim-ref [-h] [-v] -s <s> -E <E> -b <b> -t <tracefile>\n");
+    printf("-h: Optional help flag that prints usage info\n");
+    printf("-v: Optional verbose flag that displays trace info\n");
+    printf("-s <s>: Number of set index bits (S = 2^s is the number of sets)\n");
+    printf("-E <E>: Associativity (number of lines per set)\n");
+    printf("-b <b>: Number of block bits (B = 2^b is the block size)\n");
+    printf("-t <tracefile>: Name of the valgrind trace to replay, or a binary trace from synthgen\n");
+    printf("-V <n>: Optional fully associative victim buffer of n blocks next to the cache\n");
+    printf("-K: Optional skewed-associative cache, each way is indexed with a different hash\n");
+    printf("--page-size <4K|2M>: Optional TLB front end with this page size (default 4K)\n");
+    printf("--l1-tlb <entries>:<ways>[:lru|fifo]: L1 TLB geometry and replacement (default 64:4:lru)\n");
+    printf("--l2-tlb <entries>:<ways>[:lru|fifo]: L2 TLB geometry and replacement, 0 for none (default 1536:12:lru)\n");
+    printf("--timing: Optional timing model, reports cycles, AMAT and memory-level parallelism; the options below imply it\n");
+    printf("--hit-latency <c>, --victim-latency <c>, --miss-latency <c>, --tlb-latency <c>: Cycles per level (default 4, 6, 200, 7)\n");
+    printf("--mshrs <n>: Outstanding misses (default 8)\n");
+    printf("--issue-width <n>: Accesses issued per cycle (default 4)\n");
+    printf("--save-state <file>: Optional, write the final cache state and totals to file\n");
+    printf("--load-state <file>: Optional, start from a state written by --save-state for the same s, E, b, -K and -V\n");
+    printf("-L <layout>: Optional tracegen marker file; maps misses to matrix elements and writes <tracefile>.{misses,sets}.csv and <tracefile>.{A,B}.{csv,pgm}\n");
+}
+
+/**
+ * Moves the line at index to the front of its set to continue the trend that tags[setindex][0] is the MRU line and the last line is the LRU line.
+*/
+void insertAtFront(Cache *cache, int set_index, int index)
+{
+    unsigned long int *set = cache->tags[set_index];
+    unsigned long int tag = set[index];
+
+    memmove(&set[1], &set[0], index * sizeof(unsigned long int));
+    set[0] = tag;
+}
+
+/**
+ * Finds the matrix element at address: returns 0 for A, 1 for B and 2 for neither, with row and col set for A and B.
+*/
+int locate(unsigned long address, int *row, int *col)
+{
+    unsigned long bytes = (unsigned long) layout->M * layout->N * sizeof(int);
+
+    if (address >= layout->a_base && address < layout->a_base + bytes)
+    {
+        unsigned long element = (address - layout->a_base) / sizeof(int);
+        *row = element / layout->M;
+        *col = element % layout->M;
+        return 0;
+    }
+    if (address >= layout->b_base && address < layout->b_base + bytes)
+    {
+        unsigned long element = (address - layout->b_base) / sizeof(int);
+        *row = element / layout->N;
+        *col = element % layout->N;
+        return 1;
+    }
+    return 2;
+}
+
+/**
+ * Finds the first matrix element in the block starting at block, like locate(). A block that only starts inside a matrix is attributed to that matrix's first element.
+*/
+int locateBlock(Cache *cache, unsigned long block, int *row, int *col)
+{
+    int matrix = locate(block, row, col);
+    unsigned long end = block + cache->block_size;
+
+    if (matrix == 2 && layout->a_base > block && layout->a_base < end)
+    {
+        matrix = locate(layout->a_base, row, col);
+    }
+    else if (matrix == 2 && layout->b_base > block && layout->b_base < end)
+    {
+        matrix = locate(layout->b_base, row, col);
+    }
+    return matrix;
+}
+
+/**
+ * Records one miss for the conflict analysis: which element missed, and which block left the cache (or its victim buffer) if evict is set.
+*/
+void recordMiss(Cache *cache, unsigned long address, int set_index, int evict, unsigned long victim)
+{
+    unsigned long *conflicts = &layout->conflicts[set_index * CONFLICT_COLUMNS];
+    int row = 0, col = 0;
+    int matrix = locate(address, &row, &col);
+
+    conflicts[0]++;
+    if (matrix == 0)
+    {
+        layout->a_misses[row * layout->M + col]++;
+    }
+    else if (matrix == 1)
+    {
+        layout->b_misses[row * layout->N + col]++;
+    }
+    fprintf(layout->log, "%lx,%s,%d,%d,%d", address, matrix_names[matrix], row, col, set_index);
+
+    if (evict)
+    {
+        unsigned long block = victim << cache->block_bits;
+        int victim_row = 0, victim_col = 0;
+        int victim = locateBlock(cache, block, &victim_row, &victim_col);
+
+        conflicts[1]++;
+        conflicts[2 + matrix * MATRICES + victim]++;
+        fprintf(layout->log, ",%lx,%s,%d,%d\n", block, matrix_names[victim], victim_row, victim_col);
+    }
+    else
+    {
+        fprintf(layout->log, ",,,,\n");
+    }
+}
+
+/**
+ * Opens a results file of the conflict analysis named <prefix>.<suffix>, exits if that fails.
+*/
+FILE *openResults(const char *prefix, const char *suffix)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%s", prefix, suffix);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("%s: Unable to create file\n", path);
+        exit(1);
+    }
+    return file;
+}
+
+/**
+ * Reads the layout file written by tracegen (marker addresses, then the A and B addresses and M and N) and starts a conflict analysis whose results are named after prefix.
+*/
+void startAnalysis(Cache *cache, const char *layoutFile, const char *prefix)
+{
+    unsigned long long marker_start, marker_end, a_base, b_base;
+
+    FILE *file = fopen(layoutFile, "r");
+    if (file == NULL)
+    {
+        printf("%s: No such file or directory\n", layoutFile);
+        exit(1);
+    }
+    layout = malloc(sizeof(Layout));
+    if (layout == NULL)
+    {
+        printf("Unable to allocate the conflict analysis\n");
+        exit(1);
+    }
+    if (fscanf(file, "%llx %llx %llx %llx %d %d", &marker_start, &marker_end, &a_base, &b_base, &layout->M, &layout->N) != 6 || layout->M <= 0 || layout->N <= 0)
+    {
+        printf("%s: Not a layout file, regenerate it with tracegen\n", layoutFile);
+        exit(1);
+    }
+    fclose(file);
+
+    layout->a_base = a_base;
+    layout->b_base = b_base;
+    layout->a_misses = calloc((size_t) layout->M * layout->N, sizeof(unsigned int));
+    layout->b_misses = calloc((size_t) layout->M * layout->N, sizeof(unsigned int));
+    layout->conflicts = calloc(cache->sets * CONFLICT_COLUMNS, sizeof(unsigned long));
+    if (layout->a_misses == NULL || layout->b_misses == NULL || layout->conflicts == NULL)
+    {
+        printf("Unable to allocate the conflict analysis\n");
+        exit(1);
+    }
+    layout->log = openResults(prefix, "misses.csv");
+    fprintf(layout->log, "address,matrix,row,col,set,evicted_block,evicted_matrix,evicted_row,evicted_col\n");
+}
+
+// Brightest gray of the PGM heatmaps; counts are scaled into 0..HEATMAP_MAXVAL.
+#define HEATMAP_MAXVAL 255
+
+/**
+ * Writes the miss counts of one rows x cols matrix as <prefix>.<name>.csv and as a <prefix>.<name>.pgm heatmap, brightest where misses are most frequent.
+ * The CSV has the raw counts. The PGM scales them so the most frequent element is HEATMAP_MAXVAL, rounding up so any element that missed at all stays visible.
+*/
+void writeHeatmap(const char *prefix, const char *name, unsigned int *misses, int rows, int cols)
+{
+    char suffix[16];
+    unsigned int most = 1;
+
+    snprintf(suffix, sizeof(suffix), "%s.csv", name);
+    FILE *csv = openResults(prefix, suffix);
+    snprintf(suffix, sizeof(suffix), "%s.pgm", name);
+    FILE *pgm = openResults(prefix, suffix);
+
+    for (int i = 0; i < rows * cols; i++)
+    {
+        if (misses[i] > most)
+        {
+            most = misses[i];
+        }
+    }
+    fprintf(pgm, "P2\n# %s misses per element, %u at full brightness\n%d %d\n%d\n", name, most, cols, rows, HEATMAP_MAXVAL);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            fprintf(csv, j ? ",%u" : "%u", misses[i * cols + j]);
+            unsigned long gray = ((unsigned long) misses[i * cols + j] * HEATMAP_MAXVAL + most - 1) / most;
+            fprintf(pgm, j ? " %lu" : "%lu", gray);
+        }
+        fprintf(csv, "\n");
+        fprintf(pgm, "\n");
+    }
+    fclose(csv);
+    fclose(pgm);
+}
+
+/**
+ * Finishes a conflict analysis: writes the per-set conflict counts and the heatmaps of A and B, and prints the cross-matrix conflict totals.
+*/
+void finishAnalysis(Cache *cache, const char *prefix)
+{
+    unsigned long totals[MATRICES * MATRICES] = {0};
+
+    FILE *sets = openResults(prefix, "sets.csv");
+    fprintf(sets, "set,misses,evictions");
+    for (int m = 0; m < MATRICES; m++)
+    {
+        for (int v = 0; v < MATRICES; v++)
+        {
+            fprintf(sets, ",%s_evicts_%s", matrix_names[m], matrix_names[v]);
+        }
+    }
+    fprintf(sets, "\n");
+    for (int i = 0; i < cache->sets; i++)
+    {
+        unsigned long *conflicts = &layout->conflicts[i * CONFLICT_COLUMNS];
+        fprintf(sets, "%d", i);
+        for (int c = 0; c < CONFLICT_COLUMNS; c++)
+        {
+            fprintf(sets, ",%lu", conflicts[c]);
+        }
+        fprintf(sets, "\n");
+        for (int c = 0; c < MATRICES * MATRICES; c++)
+        {
+            totals[c] += conflicts[2 + c];
+        }
+    }
+    fclose(sets);
+
+    writeHeatmap(prefix, "A", layout->a_misses, layout->N, layout->M);
+    writeHeatmap(prefix, "B", layout->b_misses, layout->M, layout->N);
+    fclose(layout->log);
+
+    printf("conflicts: A evicts A:%lu A evicts B:%lu B evicts A:%lu B evicts B:%lu\n", totals[0], totals[1], totals[MATRICES], totals[MATRICES + 1]);
+
+    free(layout->a_misses);
+    free(layout->b_misses);
+    free(layout->conflicts);
+    free(layout);
+    layout = NULL;
+}
+
+/**
+ * Looks block up in a set-associative cache and makes it the MRU line of its set on a hit. Returns 1 on a hit.
+*/
+int findLRU(Cache *cache, unsigned long block)
+{
+    unsigned long int tag = block >> cache->index_bits;
+    int set_index = block & (cache->sets - 1);
+
+    for (int i = 0; i < cache->associativity; i++)
+    {
+        if (cache->tags[set_index][i] == -1)
+        {
+            break;
+        }
+        if (cache->tags[set_index][i] == tag)
+        {
+            insertAtFront(cache, set_index, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Places block as the MRU line of its set, replacing the LRU line. Returns 1 and sets victim to the block number of that line if it was valid.
+*/
+int fillLRU(Cache *cache, unsigned long block, int *set_index, unsigned long *victim)
+{
+    unsigned long int *set;
+    int evict;
+
+    *set_index = block & (cache->sets - 1);
+    set = cache->tags[*set_index];
+    evict = set[cache->associativity - 1] != -1;
+    if (evict)
+    {
+        *victim = (set[cache->associativity - 1] << cache->index_bits) | *set_index;
+    }
+
+    set[cache->associativity - 1] = block >> cache->index_bits;
+    insertAtFront(cache, *set_index, cache->associativity - 1);
+    return evict;
+}
+
+/**
+ * The set that way w of a skewed cache maps block to. Way 0 uses the usual index bits, so -K with E=1 is still direct mapped; the other ways scramble the whole block number with a different odd multiplier each, so blocks that collide in one way are spread out in the others.
+*/
+int skewIndex(Cache *cache, unsigned long block, int w)
+{
+    if (w == 0 || cache->index_bits == 0)
+    {
+        return block & (cache->sets - 1);
+    }
+    return (block * (0x9E3779B97F4A7C15UL + 2 * w)) >> (64 - cache->index_bits);
+}
+
+/**
+ * Looks block up in each way of a skewed cache and stamps it on a hit. Returns 1 on a hit.
+*/
+int findSkewed(Cache *cache, unsigned long block)
+{
+    for (int w = 0; w < cache->associativity; w++)
+    {
+        int set_index = skewIndex(cache, block, w);
+        if (cache->tags[set_index][w] == block)
+        {
+            cache->stamps[set_index][w] = ++cache->clock;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Places block in a skewed cache, in the first empty one of its candidate lines or else the least recently used one. Returns 1 and sets victim if a valid line was replaced.
+*/
+int fillSkewed(Cache *cache, unsigned long block, int *set_index, unsigned long *victim)
+{
+    int way = -1;
+
+    for (int w = 0; w < cache->associativity; w++)
+    {
+        int index = skewIndex(cache, block, w);
+        if (cache->tags[index][w] == -1)
+        {
+            way = w;
+            *set_index = index;
+            break;
+        }
+        if (way < 0 || cache->stamps[index][w] < cache->stamps[*set_index][way])
+        {
+            way = w;
+            *set_index = index;
+        }
+    }
+
+    int evict = cache->tags[*set_index][way] != -1;
+    *victim = cache->tags[*set_index][way];
+    cache->tags[*set_index][way] = block;
+    cache->stamps[*set_index][way] = ++cache->clock;
+    return evict;
+}
+
+/**
+ * Removes block from the victim buffer. Returns 1 if it was there.
+*/
+int takeVictim(Victims *victims, unsigned long block)
+{
+    for (int i = 0; i < victims->used; i++)
+    {
+        if (victims->blocks[i] == block)
+        {
+            victims->used--;
+            memmove(&victims->blocks[i], &victims->blocks[i + 1], (victims->used - i) * sizeof(unsigned long int));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds block to the victim buffer as its MRU entry. Returns 1 if the buffer was full and its LRU entry had to leave, and stores that entry in dropped.
+*/
+int putVictim(Victims *victims, unsigned long block, unsigned long *dropped)
+{
+    int full = victims->used == victims->size;
+
+    if (full)
+    {
+        *dropped = victims->blocks[victims->used - 1];
+    }
+    else
+    {
+        victims->used++;
+    }
+    memmove(&victims->blocks[1], &victims->blocks[0], (victims->used - 1) * sizeof(unsigned long int));
+    victims->blocks[0] = block;
+    return full;
+}
+
+/**
+ * Function to access the cache and determine if the access is a hit, miss, or eviction.
+ * With a victim buffer, a block found there counts as a hit and swaps places with the line it replaces, and an eviction is counted only when a block leaves the buffer.
+*/
+void accessCache(Cache *cache, unsigned long address, int *hit_count, int *miss_count, int *eviction_count)
+{
+    unsigned long block = address >> cache->block_bits;
+    unsigned long victim = 0;
+    int set_index = 0;
+
+    if (cache->skewed ? findSkewed(cache, block) : findLRU(cache, block))
+    {
+        *hit_count = *hit_count + 1;
+        if (verbose)
+        {
+            printf(" hit");
+        }
+        return;
+    }
+
+    if (cache->victims != NULL && takeVictim(cache->victims, block))
+    {
+        *hit_count = *hit_count + 1;
+        cache->victim_hits++;
+        if (verbose)
+        {
+            printf(" victim-hit");
+        }
+        if (cache->skewed ? fillSkewed(cache, block, &set_index, &victim) : fillLRU(cache, block, &set_index, &victim))
+        {
+            putVictim(cache->victims, victim, &victim);
+            cache->swaps++;
+        }
+        return;
+    }
+
+    *miss_count = *miss_count + 1;
+    if (verbose)
+    {
+        printf(" miss");
+    }
+
+    int evict_bool = cache->skewed ? fillSkewed(cache, block, &set_index, &victim) : fillLRU(cache, block, &set_index, &victim);
+    if (evict_bool && cache->victims != NULL)
+    {
+        evict_bool = putVictim(cache->victims, victim, &victim);
+    }
+    if (layout != NULL && (cache->mmu == NULL || !cache->mmu->walking))
+    {
+        recordMiss(cache, address, set_index, evict_bool, victim);
+    }
+
+    if (evict_bool)
+    {
+        *eviction_count = *eviction_count + 1;
+        if (verbose)
+        {
+            printf(" eviction");
+        }
+    }
+}
+
+/**
+ * Looks a virtual page number up in one TLB level. Returns 1 on a hit, which makes the entry MRU unless the level is FIFO.
+*/
+int findTlb(Tlb *tlb, unsigned long vpn)
+{
+    unsigned long int *set = &tlb->entries[(vpn % tlb->sets) * tlb->ways];
+
+    for (int i = 0; i < tlb->ways; i++)
+    {
+        if (set[i] == vpn)
+        {
+            if (!tlb->fifo)
+            {
+                memmove(&set[1], &set[0], i * sizeof(unsigned long int));
+                set[0] = vpn;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Puts a virtual page number at the front of its TLB set, dropping the last entry.
+*/
+void fillTlb(Tlb *tlb, unsigned long vpn)
+{
+    unsigned long int *set = &tlb->entries[(vpn % tlb->sets) * tlb->ways];
+
+    memmove(&set[1], &set[0], (tlb->ways - 1) * sizeof(unsigned long int));
+    set[0] = vpn;
+}
+
+/**
+ * Translates address through the TLBs. After a miss in both levels, the page table is walked from the root: one 8-byte load per level, at the entry that maps address, through the data cache. Entries for neighbouring pages are adjacent, so walks share cache blocks the way real radix page tables do.
+ * Returns the cycles translation adds for the timing model: nothing for an L1 TLB hit.
+*/
+int translate(Cache *cache, unsigned long address)
+{
+    Mmu *mmu = cache->mmu;
+    unsigned long vpn = address >> mmu->page_bits;
+    int levels = (mmu->page_bits == 12) ? 4 : 3;
+
+    Timing *timing = cache->timing;
+    int latency = (timing != NULL) ? timing->tlb_latency : 0;
+
+    if (findTlb(&mmu->l1, vpn))
+    {
+        mmu->l1_hits++;
+        return 0;
+    }
+    if (mmu->l2.sets > 0 && findTlb(&mmu->l2, vpn))
+    {
+        mmu->l2_hits++;
+        fillTlb(&mmu->l1, vpn);
+        if (verbose)
+        {
+            printf(" l2tlb-hit");
+        }
+        return latency;
+    }
+
+    mmu->misses++;
+    if (verbose)
+    {
+        printf(" tlb-miss [walk");
+    }
+    unsigned long virtual_address = address & ((1UL << VIRTUAL_ADDRESS_BITS) - 1);
+    mmu->walking = 1;
+    for (int level = 0; level < levels; level++)
+    {
+        unsigned long entry = PAGE_TABLE_BASE + level * PAGE_TABLE_LEVEL_BYTES + (virtual_address >> (39 - 9 * level)) * 8;
+        int hits = 0, misses = 0, evictions = 0;
+        accessCache(cache, entry, &hits, &misses, &evictions);
+        mmu->walk_hits += hits;
+        mmu->walk_misses += misses;
+        mmu->walk_evictions += evictions;
+        if (timing != NULL)
+        {
+            latency += misses ? timing->miss_latency : timing->hit_latency;
+        }
+    }
+    mmu->walking = 0;
+    if (verbose)
+    {
+        printf("]");
+    }
+    if (mmu->l2.sets > 0)
+    {
+        fillTlb(&mmu->l2, vpn);
+    }
+    fillTlb(&mmu->l1, vpn);
+    return latency;
+}
+
+/**
+ * Issues one access in the next free issue slot, returns its issue cycle.
+*/
+unsigned long issueSlot(Timing *timing)
+{
+    if (timing->slot == timing->width)
+    {
+        timing->cycle++;
+        timing->slot = 0;
+    }
+    timing->slot++;
+    return timing->cycle;
+}
+
+/**
+ * Records that an access issued at issue completed at done.
+*/
+void complete(Timing *timing, unsigned long issue, unsigned long done)
+{
+    timing->accesses++;
+    timing->latency += done - issue;
+    if (done > timing->finish)
+    {
+        timing->finish = done;
+    }
+}
+
+/**
+ * Times one data access to block that issued at issue and reached the cache after translated more cycles. The cache's answer is in miss (or victim, for a victim buffer hit).
+*/
+void timeAccess(Timing *timing, unsigned long block, unsigned long issue, int translated, int miss, int victim)
+{
+    int pending = -1;
+    int free = -1;
+    int first = 0;
+
+    // One pass over the MSHRs: the one already fetching block, a free one, and the one that frees up first.
+    for (int m = 0; m < timing->mshrs; m++)
+    {
+        if (timing->mshr_ready[m] > issue && timing->mshr_block[m] == block)
+        {
+            pending = m;
+        }
+        else if (timing->mshr_ready[m] <= issue && free < 0)
+        {
+            free = m;
+        }
+        if (timing->mshr_ready[m] < timing->mshr_ready[first])
+        {
+            first = m;
+        }
+    }
+
+    unsigned long start = issue + translated;
+    unsigned long done = start + (victim ? timing->victim_latency : timing->hit_latency);
+    timing->pending = 0;
+    if (pending >= 0)
+    {
+        // Wait for the block another access is already fetching.
+        timing->merges++;
+        timing->pending = timing->mshr_ready[pending];
+        if (timing->pending > done)
+        {
+            done = timing->pending;
+        }
+    }
+    else if (miss)
+    {
+        if (free < 0)
+        {
+            // Every MSHR is busy: issue stalls until the first one frees up.
+            unsigned long ready = timing->mshr_ready[first];
+            timing->stalls += ready - issue;
+            start += ready - issue;
+            issue = ready;
+            timing->cycle = ready;
+            timing->slot = 1;
+            free = first;
+        }
+        done = start + timing->miss_latency;
+        timing->mshr_block[free] = block;
+        timing->mshr_ready[free] = done;
+        timing->pending = done;
+        // The MSHR is held from issue, through translation, until the block arrives.
+        timing->miss_cycles += done - issue;
+        if (issue >= timing->busy_until)
+        {
+            timing->busy_cycles += done - issue;
+        }
+        else if (done > timing->busy_until)
+        {
+            timing->busy_cycles += done - timing->busy_until;
+        }
+        if (done > timing->busy_until)
+        {
+            timing->busy_until = done;
+        }
+    }
+    complete(timing, issue, done);
+}
+
 /**
- * Print for help calling and testing the Cache.
+ * Times accesses that the coalescing filter counted in bulk: hits on the block the last access touched, which still take issue slots and may have to wait for that block to arrive.
 */
-void printUsage()
+void timeHits(Timing *timing, int accesses)
 {
-    printf("Usage: ./csim-ref [-h] [-v] -s <s> -E <E> -b <b> -t <tracefile>\n");
-    printf("-h: Optional help flag that prints usage info\n");
-    printf("-v: Optional verbose flag that displays trace info\n");
-    printf("-s <s>: Number of set index bits (S = 2^s is the number of sets)\n");
-    printf("-E <E>: Associativity (number of lines per set)\n");
-    printf("-b <b>: Number of block bits (B = 2^b is the block size)\n");
-    printf("-t <tracefile>: Name of the valgrind trace to replay\n");
+    for (int i = 0; i < accesses; i++)
+    {
+        unsigned long issue = issueSlot(timing);
+        unsigned long done = issue + timing->hit_latency;
+        if (timing->pending > issue)
+        {
+            timing->merges++;
+        }
+        if (timing->pending > done)
+        {
+            done = timing->pending;
+        }
+        complete(timing, issue, done);
+    }
 }
 
 /**
- * Inserts at the front of the array to continue the trend that tags[setindex][0] is the LRU line
+ * One data access: translate it if there is a TLB front end, then access the cache, and time it if there is a timing model.
 */
-void insertAtFront(Cache *cache, int set_index, int index)
+void accessData(Cache *cache, unsigned long address, int *hit_count, int *miss_count, int *eviction_count)
 {
-    unsigned long int temp_tags[cache->sets][cache->associativity];
+    Timing *timing = cache->timing;
+    int translated = 0;
 
-    temp_tags[set_index][0] = cache->tags[set_index][index];
-
-    for (int i = 0; i < cache->associativity; i++)
+    if (timing == NULL)
     {
-        if ((i != index) && (i + 1 != cache->associativity))
-        {
-            temp_tags[set_index][i + 1] = cache->tags[set_index][i];
-
-        }
-        else if (i != index)
+        if (cache->mmu != NULL)
         {
-            temp_tags[set_index][i] = cache->tags[set_index][i];
+            translate(cache, address);
         }
+        accessCache(cache, address, hit_count, miss_count, eviction_count);
+        return;
+    }
+
+    unsigned long issue = issueSlot(timing);
+    int misses = *miss_count;
+    unsigned long victim_hits = cache->victim_hits;
+    if (cache->mmu != NULL)
+    {
+        translated = translate(cache, address);
+    }
+    accessCache(cache, address, hit_count, miss_count, eviction_count);
+    timeAccess(timing, address >> cache->block_bits, issue, translated, *miss_count > misses, cache->victim_hits > victim_hits);
+}
+
+/**
+ * Creates the timing model with the default latencies, for the options to adjust.
+*/
+Timing *createTiming()
+{
+    Timing *timing = calloc(1, sizeof(Timing));
+
+    timing->hit_latency = 4;
+    timing->victim_latency = 6;
+    timing->miss_latency = 200;
+    timing->tlb_latency = 7;
+    timing->mshrs = 8;
+    timing->width = 4;
+    return timing;
+}
 
+/**
+ * Prints the timing estimates: total cycles, average memory access time, and memory-level parallelism, the average number of misses in flight while any is.
+*/
+void printTiming(Timing *timing)
+{
+    unsigned long cycles = (timing->finish > timing->cycle + 1) ? timing->finish : timing->cycle + 1;
+    double amat = timing->accesses ? (double) timing->latency / timing->accesses : 0;
+    double mlp = timing->busy_cycles ? (double) timing->miss_cycles / timing->busy_cycles : 0;
+
+    printf("timing cycles:%lu amat:%.2f mlp:%.2f mshr merges:%lu mshr stall cycles:%lu\n", cycles, amat, mlp, timing->merges, timing->stalls);
+}
+
+/**
+ * Parses a TLB level given as <entries>:<ways>[:lru|fifo], or 0 for none, exits if it is malformed.
+*/
+void parseTlb(const char *arg, Tlb *tlb)
+{
+    int entries = 0, ways = 0;
+    char policy[8] = "lru";
+
+    if (strcmp(arg, "0") == 0)
+    {
+        tlb->sets = 0;
+        return;
+    }
+    if (sscanf(arg, "%d:%d:%7s", &entries, &ways, policy) < 2 || ways <= 0 || entries < ways || entries % ways != 0 || (strcmp(policy, "lru") != 0 && strcmp(policy, "fifo") != 0))
+    {
+        printf("%s: TLB must be <entries>:<ways>[:lru|fifo] with entries a multiple of ways\n", arg);
+        exit(1);
     }
+    tlb->sets = entries / ways;
+    tlb->ways = ways;
+    tlb->fifo = strcmp(policy, "fifo") == 0;
+}
+
+/**
+ * Creates the TLB front end with the default geometry, for the options to adjust.
+*/
+Mmu *createMmu()
+{
+    Mmu *mmu = calloc(1, sizeof(Mmu));
+
+    mmu->page_bits = 12;
+    parseTlb("64:4:lru", &mmu->l1);
+    parseTlb("1536:12:lru", &mmu->l2);
+    return mmu;
+}
 
-    for (int j = 0; j < cache->associativity; j++)
+/**
+ * Allocates the TLB entries once the geometry is final, all invalid.
+*/
+void startMmu(Mmu *mmu)
+{
+    mmu->l1.entries = malloc(mmu->l1.sets * mmu->l1.ways * sizeof(unsigned long int));
+    memset(mmu->l1.entries, 0xff, mmu->l1.sets * mmu->l1.ways * sizeof(unsigned long int));
+    if (mmu->l2.sets > 0)
     {
-        cache->tags[set_index][j] = temp_tags[set_index][j];     
+        mmu->l2.entries = malloc(mmu->l2.sets * mmu->l2.ways * sizeof(unsigned long int));
+        memset(mmu->l2.entries, 0xff, mmu->l2.sets * mmu->l2.ways * sizeof(unsigned long int));
     }
 }
 
 /**
- * Function to access the cache and determine if the access is a hit, miss, or eviction
+ * Simulates one trace record. Loads and stores access the cache once, modifies (a load then a store) access it twice, and instruction fetches are ignored. Every data access is translated first when there is a TLB front end.
 */
-void accessCache(Cache *cache, unsigned long address, int *hit_count, int *miss_count, int *eviction_count)
+void simulate(Cache *cache, char operation, unsigned long address, int size, int *hit_count, int *miss_count, int *eviction_count)
 {
+    switch(operation)
+    {
+        case 'L':
+        case 'S':
+            if (verbose)
+            {
+                printf("%c %lx,%d", operation, address, size);
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+                printf("\n");
+            }
+            else
+            {
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+            }
+            break;
+        case 'M':
+            if (verbose)
+            {
+                printf("%c %lx,%d", operation, address, size);
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+                printf("\n");
+            }
+            else
+            {
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+                accessData(cache, address, hit_count, miss_count, eviction_count);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-    unsigned long int tag = address >> ((cache->index_bits) + (cache->block_bits));
-    int set_index = (address >> (cache->block_bits)) - (tag << (cache->index_bits));
+/**
+ * Reads up to BATCH_SIZE records from a packed binary trace, returns how many were read.
+*/
+int readBinary(FILE *file, Record *records)
+{
+    unsigned long long packed[BATCH_SIZE];
+    int count = fread(packed, sizeof(packed[0]), BATCH_SIZE, file);
 
-    
+    for (int r = 0; r < count; r++)
+    {
+        records[r].operation = TRACE_BIN_OP(packed[r]);
+        records[r].address = TRACE_BIN_ADDR(packed[r]);
+        records[r].size = TRACE_BIN_SIZE(packed[r]);
+    }
+    return count;
+}
 
-    int hit_bool = 0;
-    int evict_bool = 1;
+/**
+ * Reads up to BATCH_SIZE records from a valgrind text trace, returns how many were read.
+ * Parses each line by hand with the same rules as fscanf(" %c %lx,%d"), which was most of the cost of replaying a trace. Reading stops at the first malformed line, as it did with fscanf.
+*/
+int readText(FILE *file, Record *records)
+{
+    static int stopped = 0;
+    char line[256];
+    int count = 0;
 
-    for (int i = 0; i < cache->associativity; i++)
+    while (!stopped && count < BATCH_SIZE && fgets(line, sizeof(line), file) != NULL)
     {
-        if (cache->tags[set_index][i] != -1)
+        char *p = line;
+        unsigned long address = 0;
+        int size = 0;
+        int digits = 0;
+
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
         {
-            if (cache->tags[set_index][i] == tag)
-            {
-                hit_bool = 1;
-                insertAtFront(cache, set_index, i);
+            p++;
+        }
+        if (*p == '\0')
+        {
+            continue; // blank line
+        }
+        char operation = *p++;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        for (;; p++, digits++)
+        {
+            int value;
+            if (*p >= '0' && *p <= '9')
+                value = *p - '0';
+            else if (*p >= 'a' && *p <= 'f')
+                value = *p - 'a' + 10;
+            else if (*p >= 'A' && *p <= 'F')
+                value = *p - 'A' + 10;
+            else
                 break;
-            }
+            address = (address << 4) | value;
         }
-        else
+        if (digits == 0 || *p++ != ',' || *p < '0' || *p > '9')
         {
-            evict_bool = 0;
+            stopped = 1;
             break;
         }
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            size = size * 10 + (*p - '0');
+        }
+
+        records[count].operation = operation;
+        records[count].address = address;
+        records[count].size = size;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * The coalescing filter: splits a batch of records into runs of accesses to the same block. Returns the number of runs.
+ * A run never crosses a batch, so the first access of each batch is always simulated, which costs one lookup and keeps the result exact.
+ * With a TLB a run also never crosses a page, since a block larger than a page spans several translations and each of them may miss.
+ * In a skewed cache the skipped hits would only have moved the line's timestamp forward past no other access, so the replacement order is unchanged there too; simulateRun still advances the clock for them so saved states do not depend on where batches split.
+*/
+int coalesce(Cache *cache, Record *records, int count, Run *runs)
+{
+    int nruns = 0;
+    unsigned long block = 0;
+    int shift = cache->block_bits;
+
+    if (cache->mmu != NULL && cache->mmu->page_bits < shift)
+    {
+        shift = cache->mmu->page_bits;
     }
 
-    if (hit_bool)
+    for (int r = 0; r < count; r++)
     {
-        *hit_count = *hit_count + 1;
-        if (verbose)
+        char operation = records[r].operation;
+        if (operation != 'L' && operation != 'S' && operation != 'M')
         {
-            printf(" hit");
+            continue;
+        }
+        int accesses = (operation == 'M') ? 2 : 1;
+        unsigned long next = records[r].address >> shift;
+
+        if (nruns > 0 && next == block)
+        {
+            runs[nruns - 1].last = r;
+            runs[nruns - 1].hits += accesses;
+        }
+        else
+        {
+            runs[nruns].first = r;
+            runs[nruns].last = r;
+            runs[nruns].hits = accesses - 1;
+            nruns++;
+            block = next;
+        }
+    }
+    return nruns;
+}
+
+/**
+ * Advances the clock of a skewed cache over accesses to block that the coalescing filter counted in bulk, and stamps the block's line with the last of them, as simulating them one by one would.
+*/
+void stampRun(Cache *cache, unsigned long address, int accesses)
+{
+    if (cache->skewed && accesses > 0)
+    {
+        cache->clock += accesses - 1;
+        findSkewed(cache, address >> cache->block_bits);
+    }
+}
+
+/**
+ * Simulates one run from the coalescing filter: its first access goes through the cache and the rest are counted as hits in bulk.
+ * In verbose mode every record of the run is still printed, exactly as if it had been simulated on its own.
+*/
+void simulateRun(Cache *cache, Record *records, Run *run, int *hit_count, int *miss_count, int *eviction_count)
+{
+    Record *first = &records[run->first];
+
+    // The rest of the run is on the same page as well, so it also hits the L1 TLB.
+    if (!verbose)
+    {
+        accessData(cache, first->address, hit_count, miss_count, eviction_count);
+        *hit_count += run->hits;
+        if (cache->mmu != NULL)
+        {
+            cache->mmu->l1_hits += run->hits;
+        }
+        if (cache->timing != NULL)
+        {
+            timeHits(cache->timing, run->hits);
+        }
+        stampRun(cache, first->address, run->hits);
+        return;
+    }
+
+    simulate(cache, first->operation, first->address, first->size, hit_count, miss_count, eviction_count);
+    for (int r = run->first + 1; r <= run->last; r++)
+    {
+        switch(records[r].operation)
+        {
+            case 'L':
+            case 'S':
+                printf("%c %lx,%d hit\n", records[r].operation, records[r].address, records[r].size);
+                *hit_count = *hit_count + 1;
+                if (cache->mmu != NULL)
+                {
+                    cache->mmu->l1_hits += 1;
+                }
+                if (cache->timing != NULL)
+                {
+                    timeHits(cache->timing, 1);
+                }
+                break;
+            case 'M':
+                printf("%c %lx,%d hit hit\n", records[r].operation, records[r].address, records[r].size);
+                *hit_count = *hit_count + 2;
+                if (cache->mmu != NULL)
+                {
+                    cache->mmu->l1_hits += 2;
+                }
+                if (cache->timing != NULL)
+                {
+                    timeHits(cache->timing, 2);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    stampRun(cache, first->address, run->hits - (first->operation == 'M'));
+}
+
+/**
+ * Allocates the tags (and timestamps of a skewed cache) as one contiguous block each, the layout of a state file, and marks every line invalid.
+*/
+void allocateLines(Cache *cache)
+{
+    unsigned long int *lines = malloc(cache->sets * cache->associativity * sizeof(unsigned long int));
+
+    cache->tags = malloc(cache->sets * sizeof(unsigned long int *));
+    memset(lines, 0xff, cache->sets * cache->associativity * sizeof(unsigned long int));
+    for (int i = 0; i < cache->sets; i++)
+    {
+        cache->tags[i] = lines + i * cache->associativity;
+    }
+
+    if (cache->skewed)
+    {
+        unsigned long int *stamps = calloc(cache->sets * cache->associativity, sizeof(unsigned long int));
+        cache->stamps = malloc(cache->sets * sizeof(unsigned long int *));
+        for (int i = 0; i < cache->sets; i++)
+        {
+            cache->stamps[i] = stamps + i * cache->associativity;
         }
     }
+}
+
+/**
+ * Frees the lines, or unmaps them if they came from a state file.
+*/
+void freeLines(Cache *cache)
+{
+    if (cache->mapping != NULL)
+    {
+        munmap(cache->mapping, cache->mapping_size);
+    }
     else
     {
-        *miss_count = *miss_count + 1;
-        if (verbose)
+        free(cache->tags[0]);
+        if (cache->skewed)
         {
-            printf(" miss");
+            free(cache->stamps[0]);
         }
+    }
+    free(cache->tags);
+    free(cache->stamps);
+}
+
+/**
+ * Writes the cache state and the running totals to stateFile.
+ * The state goes to a temporary file next to stateFile that then replaces it, so a run may save over the state it loaded: that file is still mapped, and truncating it would pull the pages out from under the run.
+*/
+void saveState(Cache *cache, const char *stateFile, unsigned long hits, unsigned long misses, unsigned long evictions)
+{
+    size_t lines = cache->sets * cache->associativity;
+    Victims *victims = cache->victims;
+    StateHeader header = {STATE_MAGIC, cache->index_bits, cache->associativity, cache->block_bits, cache->skewed, cache->clock, hits, misses, evictions, {0, 0}};
+    if (victims != NULL)
+    {
+        header.reserved[0] = victims->size;
+        header.reserved[1] = victims->used;
+    }
+
+    char tempFile[4096];
+    snprintf(tempFile, sizeof(tempFile), "%s.XXXXXX", stateFile);
+    int fd = mkstemp(tempFile);
+    FILE *file = (fd < 0) ? NULL : fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        printf("%s: Unable to create file\n", stateFile);
+        exit(1);
+    }
+    // mkstemp creates the file for its owner only; give it the permissions fopen would have.
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < cache->sets; i++)
+    {
+        ok = fwrite(cache->tags[i], sizeof(unsigned long int), cache->associativity, file) == cache->associativity;
+    }
+    for (int i = 0; ok && cache->skewed && i < cache->sets; i++)
+    {
+        ok = fwrite(cache->stamps[i], sizeof(unsigned long int), cache->associativity, file) == cache->associativity;
+    }
+    if (ok && victims != NULL)
+    {
+        ok = fwrite(victims->blocks, sizeof(unsigned long int), victims->size, file) == victims->size;
+    }
+    if (fclose(file) != 0 || !ok || rename(tempFile, stateFile) != 0)
+    {
+        printf("%s: Unable to write %zu lines of cache state\n", stateFile, lines);
+        unlink(tempFile);
+        exit(1);
+    }
+}
+
+/**
+ * Maps a state written by --save-state in place of freshly allocated lines. The mapping is private, so the run changes its own copy of the pages and many runs can start from one file. Sets the totals the state was saved with, and copies the victim buffer into the cache's own.
+*/
+void loadState(Cache *cache, const char *stateFile, unsigned long *hits, unsigned long *misses, unsigned long *evictions)
+{
+    struct stat info;
+    StateHeader saved;
+    Victims *victims = cache->victims;
+    int victim_size = (victims != NULL) ? victims->size : 0;
+    size_t lines = cache->sets * cache->associativity;
+    size_t size = sizeof(StateHeader) + ((cache->skewed ? 2 : 1) * lines + victim_size) * sizeof(unsigned long int);
 
-        if (evict_bool)
+    FILE *file = fopen(stateFile, "rb");
+    if (file == NULL)
+    {
+        printf("%s: No such file or directory\n", stateFile);
+        exit(1);
+    }
+    if (fread(&saved, sizeof(saved), 1, file) != 1 || memcmp(saved.magic, STATE_MAGIC, sizeof(saved.magic)) != 0)
+    {
+        printf("%s: Not a state file\n", stateFile);
+        exit(1);
+    }
+    if (saved.index_bits != cache->index_bits || saved.associativity != cache->associativity || saved.block_bits != cache->block_bits || saved.skewed != cache->skewed || saved.reserved[0] != victim_size)
+    {
+        printf("%s: Not a state file for this cache (saved with s=%d E=%d b=%d%s", stateFile, saved.index_bits, saved.associativity, saved.block_bits, saved.skewed ? " -K" : "");
+        if (saved.reserved[0] != 0)
         {
-            *eviction_count = *eviction_count + 1;
-            if (verbose)
-            {
-                printf(" eviction");
-            }
+            printf(" -V %lu", (unsigned long) saved.reserved[0]);
         }
+        printf(")\n");
+        exit(1);
+    }
+    if (fstat(fileno(file), &info) != 0 || info.st_size != size || saved.reserved[1] > saved.reserved[0])
+    {
+        printf("%s: Not a state file for this cache\n", stateFile);
+        exit(1);
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (mapping == MAP_FAILED)
+    {
+        printf("%s: Unable to map file\n", stateFile);
+        exit(1);
+    }
+
+    StateHeader *header = mapping;
+    freeLines(cache);
+    cache->mapping = mapping;
+    cache->mapping_size = size;
+    cache->clock = header->clock;
+    *hits = header->hits;
+    *misses = header->misses;
+    *evictions = header->evictions;
 
-        cache->tags[set_index][(cache->associativity) - 1] = tag;
-        insertAtFront(cache, set_index, ((cache->associativity) - 1));
+    unsigned long int *tags = (unsigned long int *) (header + 1);
+    cache->tags = malloc(cache->sets * sizeof(unsigned long int *));
+    for (int i = 0; i < cache->sets; i++)
+    {
+        cache->tags[i] = tags + i * cache->associativity;
+    }
+    if (cache->skewed)
+    {
+        cache->stamps = malloc(cache->sets * sizeof(unsigned long int *));
+        for (int i = 0; i < cache->sets; i++)
+        {
+            cache->stamps[i] = tags + lines + i * cache->associativity;
+        }
+    }
+    if (victims != NULL)
+    {
+        victims->used = header->reserved[1];
+        memcpy(victims->blocks, tags + (cache->skewed ? 2 : 1) * lines, victim_size * sizeof(unsigned long int));
     }
-    
-    return; 
 }
+
 /**
  * Main Method to run the program, determine what type of operation is occuring, and perform the operation. Also does cache setup/global flag initialization.
 */
 int main(int argc, char** argv)
 {
-    Cache cache;
+    Cache cache = {0};
 
     int hit_count = 0;
     int miss_count = 0;
     int eviction_count = 0;
     int option = 0;
 
-    char *traceFile;
+    char *traceFile = NULL;
+    char *layoutFile = NULL;
+    char *saveFile = NULL;
+    char *loadFile = NULL;
+    struct option longOptions[] =
+    {
+        {"page-size", required_argument, NULL, 'P'},
+        {"l1-tlb", required_argument, NULL, '1'},
+        {"l2-tlb", required_argument, NULL, '2'},
+        {"save-state", required_argument, NULL, 'W'},
+        {"load-state", required_argument, NULL, 'R'},
+        {"timing", no_argument, NULL, 'T'},
+        {"hit-latency", required_argument, NULL, 'H'},
+        {"victim-latency", required_argument, NULL, 'C'},
+        {"miss-latency", required_argument, NULL, 'M'},
+        {"tlb-latency", required_argument, NULL, 'D'},
+        {"mshrs", required_argument, NULL, 'Q'},
+        {"issue-width", required_argument, NULL, 'I'},
+        {0, 0, 0, 0}
+    };
     // Determine what arguments were passed.
-    while ((option = getopt(argc, argv, "hvs:E:b:t:")) != -1)
+    while ((option = getopt_long(argc, argv, "hvs:E:b:t:V:KL:", longOptions, NULL)) != -1)
     {
         // Initialization of fields.
         switch(option)
@@ -176,97 +1470,203 @@ int main(int argc, char** argv)
             case 't':
                 traceFile = optarg;
                 break;
+            case 'V':
+                cache.victims = malloc(sizeof(Victims));
+                cache.victims->size = atoi(optarg);
+                cache.victims->used = 0;
+                break;
+            case 'K':
+                cache.skewed = 1;
+                break;
+            case 'L':
+                layoutFile = optarg; // conflict analysis.
+                break;
+            case 'P':
+                if (cache.mmu == NULL)
+                {
+                    cache.mmu = createMmu();
+                }
+                if (strcmp(optarg, "4K") == 0 || strcmp(optarg, "4k") == 0)
+                {
+                    cache.mmu->page_bits = 12;
+                }
+                else if (strcmp(optarg, "2M") == 0 || strcmp(optarg, "2m") == 0)
+                {
+                    cache.mmu->page_bits = 21;
+                }
+                else
+                {
+                    printf("%s: Page size must be 4K or 2M\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'T':
+            case 'H':
+            case 'C':
+            case 'M':
+            case 'D':
+            case 'Q':
+            case 'I':
+                if (cache.timing == NULL)
+                {
+                    cache.timing = createTiming();
+                }
+                if (option != 'T' && (atoi(optarg) < 0 || ((option == 'Q' || option == 'I') && atoi(optarg) <= 0)))
+                {
+                    printf("%s: Latencies must not be negative, and MSHRs and issue width must be positive\n", optarg);
+                    exit(1);
+                }
+                switch(option)
+                {
+                    case 'H': cache.timing->hit_latency = atoi(optarg); break;
+                    case 'C': cache.timing->victim_latency = atoi(optarg); break;
+                    case 'M': cache.timing->miss_latency = atoi(optarg); break;
+                    case 'D': cache.timing->tlb_latency = atoi(optarg); break;
+                    case 'Q': cache.timing->mshrs = atoi(optarg); break;
+                    case 'I': cache.timing->width = atoi(optarg); break;
+                }
+                break;
+            case 'W':
+                saveFile = optarg;
+                break;
+            case 'R':
+                loadFile = optarg;
+                break;
+            case '1':
+            case '2':
+                if (cache.mmu == NULL)
+                {
+                    cache.mmu = createMmu();
+                }
+                parseTlb(optarg, (option == '1') ? &cache.mmu->l1 : &cache.mmu->l2);
+                if (cache.mmu->l1.sets == 0)
+                {
+                    printf("The L1 TLB cannot be disabled\n");
+                    exit(1);
+                }
+                break;
             default:
                 exit(1);
         }
     }
+    if (traceFile == NULL)
+    {
+        printf("Missing required command line argument\n");
+        printUsage();
+        exit(1);
+    }
     // Field Initialization
     cache.sets = pow(2.0, cache.index_bits);
     cache.block_size = pow(2.0, cache.block_bits);
-    // Array Allocation
-    cache.tags = malloc(cache.sets * sizeof(unsigned long int *));
-  
-    for (int i = 0; i < cache.sets; i++)
-    {
-        cache.tags[i] = malloc(cache.associativity * sizeof(unsigned long int));
-    }
-    // initialization of the tags for validity and checking for need to eviction in access.
-    for (int j = 0; j < cache.sets; j++)
+    // Array Allocation, all tags -1 for validity and checking for need to eviction in access.
+    allocateLines(&cache);
+    if (cache.victims != NULL)
     {
-        for (int k = 0; k < cache.associativity; k++)
+        if (cache.victims->size <= 0)
         {
-            cache.tags[j][k] = -1;
+            printf("-V needs a positive number of blocks\n");
+            exit(1);
         }
+        cache.victims->blocks = malloc(cache.victims->size * sizeof(unsigned long int));
+    }
+    // Or continue from a saved state; this run's counts start from zero either way. The TLBs are not part of a state.
+    unsigned long saved_hits = 0, saved_misses = 0, saved_evictions = 0;
+    if ((loadFile != NULL || saveFile != NULL) && cache.mmu != NULL)
+    {
+        printf("--save-state and --load-state do not keep the TLBs, leave out --page-size, --l1-tlb and --l2-tlb\n");
+        exit(1);
+    }
+    if (loadFile != NULL)
+    {
+        loadState(&cache, loadFile, &saved_hits, &saved_misses, &saved_evictions);
+    }
+    if (cache.mmu != NULL)
+    {
+        startMmu(cache.mmu);
+    }
+    if (cache.timing != NULL)
+    {
+        cache.timing->mshr_block = calloc(cache.timing->mshrs, sizeof(unsigned long int));
+        cache.timing->mshr_ready = calloc(cache.timing->mshrs, sizeof(unsigned long int));
+    }
+    if (layoutFile != NULL)
+    {
+        startAnalysis(&cache, layoutFile, traceFile);
     }
     // File opening/reading.
-    FILE *file = fopen(traceFile, "r");
+    FILE *file = fopen(traceFile, "rb");
+    if (file == NULL)
+    {
+        printf("%s: No such file or directory\n", traceFile);
+        exit(1);
+    }
 
-    char operation;
-    unsigned long address;
-    int size;
-    // Scan the file and initialize the operation/address/size fields.
-    if (file != NULL)
+    Record records[BATCH_SIZE];
+    Run runs[BATCH_SIZE];
+    int count;
+    char magic[TRACE_BIN_MAGIC_LEN];
+    int binary = fread(magic, 1, TRACE_BIN_MAGIC_LEN, file) == TRACE_BIN_MAGIC_LEN && memcmp(magic, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN) == 0;
+    if (!binary)
     {
-        while(fscanf(file, " %c %lx,%d", &operation, &address, &size) == 3)
+        rewind(file);
+    }
+    // Read a batch, collapse it into runs and simulate the runs.
+    while ((count = binary ? readBinary(file, records) : readText(file, records)) > 0)
+    {
+        int nruns = coalesce(&cache, records, count, runs);
+        for (int r = 0; r < nruns; r++)
         {
-            switch(operation)
-            {
-                case 'I':
-                    break;
-                case 'L':
-                    if (verbose)
-                    {
-                        printf("%c %lx,%d", operation, address, size);
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                        printf("\n");
-                    }
-                    else
-                    {
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                    }
-                    break;
-                case 'S':
-                    if (verbose)
-                    {
-                        printf("%c %lx,%d", operation, address, size);
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                        printf("\n");
-                    }
-                    else
-                    {
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                    }
-                    break;
-                case 'M':
-                    if (verbose)
-                    {
-                        printf("%c %lx,%d", operation, address, size);
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                        printf("\n");
-                    }
-                    else
-                    {
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                        accessCache(&cache, address, &hit_count, &miss_count, &eviction_count);
-                    }
-                    break;
-                default:
-                    break;
-            }
+            simulateRun(&cache, records, &runs[r], &hit_count, &miss_count, &eviction_count);
         }
     }
 
     // Print and close.
     printSummary(hit_count, miss_count, eviction_count);
+    if (cache.victims != NULL)
+    {
+        printf("victim hits:%lu swaps:%lu\n", cache.victim_hits, cache.swaps);
+    }
+    if (loadFile != NULL)
+    {
+        printf("loaded state after hits:%lu misses:%lu evictions:%lu\n", saved_hits, saved_misses, saved_evictions);
+    }
+    if (cache.mmu != NULL)
+    {
+        printf("tlb l1 hits:%lu l2 hits:%lu misses:%lu walk hits:%lu walk misses:%lu walk evictions:%lu\n", cache.mmu->l1_hits, cache.mmu->l2_hits, cache.mmu->misses, cache.mmu->walk_hits, cache.mmu->walk_misses, cache.mmu->walk_evictions);
+    }
+    if (cache.timing != NULL)
+    {
+        printTiming(cache.timing);
+    }
+    if (layout != NULL)
+    {
+        finishAnalysis(&cache, traceFile);
+    }
     fclose(file);
+    if (saveFile != NULL)
+    {
+        saveState(&cache, saveFile, saved_hits + hit_count, saved_misses + miss_count, saved_evictions + eviction_count);
+    }
 
     //free memory
-    for (int x = 0; x < cache.sets; x ++)
+    freeLines(&cache);
+    if (cache.victims != NULL)
+    {
+        free(cache.victims->blocks);
+        free(cache.victims);
+    }
+    if (cache.timing != NULL)
+    {
+        free(cache.timing->mshr_block);
+        free(cache.timing->mshr_ready);
+        free(cache.timing);
+    }
+    if (cache.mmu != NULL)
     {
-        free(cache.tags[x]);
+        free(cache.mmu->l1.entries);
+        free(cache.mmu->l2.entries);
+        free(cache.mmu);
     }
-    free(cache.tags);
 
     return 0;
 }
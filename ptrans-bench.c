@@ -0,0 +1,155 @@
+/*
+ * ptrans-bench.c - Measures how the parallel transpose in ptrans.c
+ *     scales from 1 to N threads on a large heap-allocated matrix.
+ *
+ * For each thread count the output is allocated (and first-touched) by
+ * a fresh pool, one untimed run warms it up, and the best of several
+ * timed runs is reported with its throughput and speedup over 1 thread.
+ */
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime and sysconf */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "cachelab.h"
+
+/* Globals set on the command line */
+static int rows = 4096;
+static int cols = 4096;
+static int max_threads = 0;
+static int reps = 5;
+
+/*
+ * checkTranspose - Verify B against the pattern A was filled with
+ */
+static int checkTranspose(const int *B)
+{
+    size_t i, j;
+
+    for (j = 0; j < cols; j++)
+        for (i = 0; i < rows; i++)
+            if (B[j * rows + i] != (int) (i * cols + j))
+                return 0;
+    return 1;
+}
+
+/*
+ * benchThreads - Time the transpose with nthreads workers, returns the
+ *     best time in seconds
+ */
+static double benchThreads(const int *A, int nthreads, long *steals)
+{
+    int r;
+    double secs, best = 0;
+    struct timespec start, end;
+    ptrans_pool_t *pool = ptransCreate(nthreads);
+    int *B = ptransAlloc(pool, rows, cols);
+
+    if (B == NULL) {
+        printf("Error: unable to allocate a %dx%d matrix\n", cols, rows);
+        exit(1);
+    }
+
+    /* Warm up, then keep the best of the timed runs */
+    ptrans(pool, rows, cols, A, B);
+    *steals = 0;
+    for (r = 0; r < reps; r++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        *steals += ptrans(pool, rows, cols, A, B);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = elapsed(&start, &end);
+        if (r == 0 || secs < best)
+            best = secs;
+    }
+
+    if (!checkTranspose(B)) {
+        printf("Error: %d-thread transpose is incorrect\n", nthreads);
+        exit(1);
+    }
+    free(B);
+    ptransDestroy(pool);
+    return best;
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[])
+{
+    printf("Usage: %s [-h] [-r <rows>] [-c <cols>] [-t <threads>] [-n <reps>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h            Print this help message.\n");
+    printf("  -r <rows>     Rows of A (default %d)\n", rows);
+    printf("  -c <cols>     Columns of A (default %d)\n", cols);
+    printf("  -t <threads>  Largest thread count to run (default: online CPUs)\n");
+    printf("  -n <reps>     Timed runs per thread count (default %d)\n", reps);
+}
+
+/*
+ * main - Main routine
+ */
+int main(int argc, char* argv[])
+{
+    char c;
+    size_t i;
+    int t;
+    long steals;
+    double secs, base = 0;
+
+    while ((c = getopt(argc, argv, "r:c:t:n:h")) != -1) {
+        switch(c) {
+        case 'r':
+            rows = atoi(optarg);
+            break;
+        case 'c':
+            cols = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            reps = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (max_threads <= 0)
+        max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (rows <= 0 || cols <= 0 || reps <= 0 || max_threads <= 0) {
+        usage(argv);
+        exit(1);
+    }
+
+    int *A = malloc((size_t) rows * cols * sizeof(int));
+    if (A == NULL) {
+        printf("Error: unable to allocate a %dx%d matrix\n", rows, cols);
+        exit(1);
+    }
+    for (i = 0; i < (size_t) rows * cols; i++)
+        A[i] = (int) i;
+
+    printf("Transposing %dx%d ints (%.1f MB per matrix), best of %d runs\n",
+           rows, cols, (double) rows * cols * sizeof(int) / (1 << 20), reps);
+    printf("%8s %12s %10s %8s %8s\n", "threads", "ms", "GB/s", "speedup", "steals");
+
+    /* Powers of two, then the requested maximum */
+    for (t = 1; ; t = (t * 2 > max_threads && t < max_threads) ? max_threads : t * 2) {
+        secs = benchThreads(A, t, &steals);
+        if (t == 1)
+            base = secs;
+        printf("%8d %12.3f %10.2f %8.2f %8ld\n", t, secs * 1e3,
+               2.0 * sizeof(int) * rows * cols / secs / 1e9, base / secs, steals / reps);
+        if (t >= max_threads)
+            break;
+    }
+
+    free(A);
+    return 0;
+}
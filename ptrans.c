@@ -0,0 +1,304 @@
+/*
+ * ptrans.c - Multithreaded transpose for matrices too large for the
+ *     static 256x256 arrays used by tracegen and test-trans
+ *
+ * The output B (cols x rows) is cut into strips of PTRANS_STRIP rows,
+ * and each strip is transposed in tiles small enough that the A and B
+ * data of one tile stay in cache, using the register-tile kernels from
+ * trans-simd.c. Strips are handed out by a persistent pool of threads:
+ * every worker starts with a contiguous range of strips, takes from the
+ * front of its own range and steals from the back of other workers'
+ * ranges once it runs dry. ptransAlloc() first-touches each strip from
+ * the worker that owns it initially, so on NUMA machines the pages of
+ * B land on the node that will usually write them.
+ */
+#define _POSIX_C_SOURCE 200809L /* for posix_memalign */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include "cachelab.h"
+
+/* Output rows per strip, the unit of scheduling and first touch */
+#define PTRANS_STRIP 32
+
+/* Bytes of A plus B touched by one tile within a strip */
+#define PTRANS_TILE_BYTES (128 * 1024)
+
+/* Work to do on each strip */
+enum ptrans_kind {TOUCH, TRANSPOSE};
+
+/*
+ * A worker's remaining strips [next, end), packed into one word so the
+ *     owner and thieves can claim strips with a single compare-and-swap.
+ *     Padded to a cache line so workers do not false-share.
+ */
+typedef struct ptrans_queue {
+    uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} ptrans_queue_t;
+
+struct ptrans_pool {
+    int nthreads;
+    pthread_t *threads;
+    ptrans_queue_t *queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;      /* signalled when a new job is posted */
+    pthread_cond_t done;       /* signalled when the last worker finishes */
+    unsigned long generation;  /* bumped for every job */
+    int pending;               /* workers still running the current job */
+    int shutdown;
+
+    /* The current job */
+    enum ptrans_kind kind;
+    int rows, cols;
+    const int *A;
+    int *B;
+    int nstrips;
+    long steals;
+};
+
+/* Helper to pass a worker its pool and id */
+struct ptrans_worker {
+    ptrans_pool_t *pool;
+    int id;
+};
+
+static uint64_t pack(uint32_t next, uint32_t end)
+{
+    return ((uint64_t) end << 32) | next;
+}
+
+/*
+ * takeFront - Owner side: claim the first strip of queue q, -1 if empty
+ */
+static int takeFront(ptrans_queue_t *q)
+{
+    uint64_t old = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    uint32_t next, end;
+
+    do {
+        next = (uint32_t) old;
+        end = (uint32_t) (old >> 32);
+        if (next >= end)
+            return -1;
+    } while (!__atomic_compare_exchange_n(&q->range, &old, pack(next + 1, end), 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return next;
+}
+
+/*
+ * takeBack - Thief side: claim the last strip of queue q, -1 if empty
+ */
+static int takeBack(ptrans_queue_t *q)
+{
+    uint64_t old = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    uint32_t next, end;
+
+    do {
+        next = (uint32_t) old;
+        end = (uint32_t) (old >> 32);
+        if (next >= end)
+            return -1;
+    } while (!__atomic_compare_exchange_n(&q->range, &old, pack(next, end - 1), 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return end - 1;
+}
+
+/*
+ * doStrip - Touch or transpose output rows [r0, r1) of B, i.e. columns
+ *     [r0, r1) of A, a tile of A rows at a time
+ */
+static void doStrip(ptrans_pool_t *pool, int strip)
+{
+    size_t rows = pool->rows, cols = pool->cols;
+    int r0 = strip * PTRANS_STRIP;
+    int r1 = (r0 + PTRANS_STRIP < pool->cols) ? r0 + PTRANS_STRIP : pool->cols;
+    int tile = PTRANS_TILE_BYTES / (2 * sizeof(int) * PTRANS_STRIP);
+    int c, h;
+
+    if (pool->kind == TOUCH) {
+        memset(pool->B + r0 * rows, 0, (r1 - r0) * rows * sizeof(int));
+        return;
+    }
+    for (c = 0; c < pool->rows; c += tile) {
+        h = (pool->rows - c < tile) ? pool->rows - c : tile;
+        transStrided(h, r1 - r0, pool->A + c * cols + r0, cols,
+                     pool->B + r0 * rows + c, rows);
+    }
+}
+
+/*
+ * runJob - A worker's share of the current job: its own strips first,
+ *     then strips stolen from the other workers
+ */
+static void runJob(ptrans_pool_t *pool, int id)
+{
+    int strip, v;
+    long steals = 0;
+
+    while ((strip = takeFront(&pool->queues[id])) >= 0)
+        doStrip(pool, strip);
+
+    /* First touch placement only holds if owners touch their own strips */
+    if (pool->kind == TOUCH)
+        return;
+
+    for (v = 1; v < pool->nthreads; v++) {
+        ptrans_queue_t *victim = &pool->queues[(id + v) % pool->nthreads];
+        while ((strip = takeBack(victim)) >= 0) {
+            doStrip(pool, strip);
+            steals++;
+        }
+    }
+    __atomic_add_fetch(&pool->steals, steals, __ATOMIC_RELAXED);
+}
+
+/*
+ * workerMain - Wait for jobs and run them until the pool shuts down
+ */
+static void *workerMain(void *arg)
+{
+    struct ptrans_worker *self = arg;
+    ptrans_pool_t *pool = self->pool;
+    unsigned long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runJob(pool, self->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(self);
+    return NULL;
+}
+
+/*
+ * runPool - Split the strips evenly among the workers and run a job
+ */
+static void runPool(ptrans_pool_t *pool, enum ptrans_kind kind,
+                    int rows, int cols, const int *A, int *B)
+{
+    int w;
+
+    pool->kind = kind;
+    pool->rows = rows;
+    pool->cols = cols;
+    pool->A = A;
+    pool->B = B;
+    pool->nstrips = (cols + PTRANS_STRIP - 1) / PTRANS_STRIP;
+    pool->steals = 0;
+
+    /* The same static split decides first touch and initial ownership */
+    for (w = 0; w < pool->nthreads; w++) {
+        uint32_t lo = (uint64_t) pool->nstrips * w / pool->nthreads;
+        uint32_t hi = (uint64_t) pool->nstrips * (w + 1) / pool->nthreads;
+        __atomic_store_n(&pool->queues[w].range, pack(lo, hi), __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * ptransCreate - Start a pool of nthreads workers
+ */
+ptrans_pool_t *ptransCreate(int nthreads)
+{
+    int w;
+    ptrans_pool_t *pool = calloc(1, sizeof(ptrans_pool_t));
+    assert(pool && nthreads > 0);
+
+    /* Resolve the SIMD kernel now; workers then only ever read it */
+    initStrided();
+
+    pool->nthreads = nthreads;
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    assert(pool->threads);
+    if (posix_memalign((void **) &pool->queues, 64, nthreads * sizeof(ptrans_queue_t)) != 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    memset(pool->queues, 0, nthreads * sizeof(ptrans_queue_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (w = 0; w < nthreads; w++) {
+        struct ptrans_worker *self = malloc(sizeof(struct ptrans_worker));
+        assert(self);
+        self->pool = pool;
+        self->id = w;
+        if (pthread_create(&pool->threads[w], NULL, workerMain, self) != 0) {
+            fprintf(stderr, "Error: unable to create worker thread\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+/*
+ * ptransDestroy - Stop the workers and free the pool
+ */
+void ptransDestroy(ptrans_pool_t *pool)
+{
+    int w;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (w = 0; w < pool->nthreads; w++)
+        pthread_join(pool->threads[w], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
+
+/*
+ * ptransAlloc - Allocate the cols x rows output for transposing a
+ *     rows x cols matrix, first-touched strip by strip by its owner
+ */
+int *ptransAlloc(ptrans_pool_t *pool, int rows, int cols)
+{
+    int *B;
+
+    if (posix_memalign((void **) &B, 64, (size_t) rows * cols * sizeof(int)) != 0)
+        return NULL;
+    runPool(pool, TOUCH, rows, cols, NULL, B);
+    return B;
+}
+
+/*
+ * ptrans - B = A^T for a rows x cols matrix A, using every worker in the pool.
+ *     Returns the number of strips that were stolen from their initial owner.
+ */
+long ptrans(ptrans_pool_t *pool, int rows, int cols, const int *A, int *B)
+{
+    runPool(pool, TRANSPOSE, rows, cols, A, B);
+    return pool->steals;
+}
@@ -0,0 +1,466 @@
+/*
+ * synthgen.c - Synthetic workload generator for scale and stress testing
+ *     the cache simulator
+ *
+ * Streams any number of accesses drawn from one or more patterns:
+ * sequential, strided, uniformly random, Zipfian hot blocks, a
+ * pointer chase through every block of the working set, and the
+ * row-in/column-out tile walk of a blocked matrix transpose. Several
+ * patterns can be mixed with weights; the generator then switches
+ * pattern every BURST accesses. Output is either the valgrind text
+ * format csim reads, or the packed binary format from cachelab.h.
+ *
+ * The RNG is a seeded xoshiro256**, so the same options always produce
+ * the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include "cachelab.h"
+
+/* Accesses generated in a row from one pattern when patterns are mixed */
+#define BURST 64
+
+/* Granularity of the block-oriented patterns (zipf, chase), in bytes */
+#define LINE 64
+
+/* Size of the output buffer */
+#define OUTBUF (1 << 20)
+
+enum pattern {SEQ, STRIDE, UNIFORM, ZIPF, CHASE, TILES, NPATTERNS};
+static const char *pattern_names[NPATTERNS] = {"seq", "stride", "uniform", "zipf", "chase", "tiles"};
+
+/* Globals set on the command line */
+static uint64_t count = 1000000;
+static uint64_t seed = 1;
+static uint64_t base = 0x10000000;
+static uint64_t wset = 1 << 24;      /* working set in bytes */
+static uint64_t stride = 256;
+static int elem = 4;                 /* access size in bytes */
+static double alpha = 1.0;           /* Zipf exponent */
+static int tile = 8;                 /* tile side for the tiles pattern */
+static int pct_load = 70, pct_store = 25, pct_modify = 5;
+static int binary = 0;
+static int weights[NPATTERNS];
+
+/* xoshiro256** state */
+static uint64_t rng[4];
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * next - Next 64 random bits
+ */
+static inline uint64_t next(void)
+{
+    uint64_t result = rotl(rng[1] * 5, 7) * 9;
+    uint64_t t = rng[1] << 17;
+
+    rng[2] ^= rng[0];
+    rng[3] ^= rng[1];
+    rng[1] ^= rng[2];
+    rng[0] ^= rng[3];
+    rng[2] ^= t;
+    rng[3] = rotl(rng[3], 45);
+    return result;
+}
+
+/*
+ * seedRng - Expand the seed into the xoshiro state with splitmix64
+ */
+static void seedRng(uint64_t s)
+{
+    int i;
+    uint64_t z;
+
+    for (i = 0; i < 4; i++) {
+        z = (s += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        rng[i] = z ^ (z >> 31);
+    }
+}
+
+/* Uniform integer in [0, n) */
+static inline uint64_t below(uint64_t n)
+{
+    return (uint64_t) (((unsigned __int128) next() * n) >> 64);
+}
+
+/* Uniform double in [0, 1) */
+static inline double unit(void)
+{
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Seeded bijection on [0, nblocks), so hot Zipf ranks and the chase
+ * order are scattered over the working set instead of running in
+ * address order. Permutes the enclosing power of two and cycle-walks
+ * values that fall outside the range.
+ */
+static uint64_t perm_mask, perm_key;
+
+static inline uint64_t permute(uint64_t x, uint64_t n)
+{
+    do {
+        x = (x * 0x9e3779b97f4a7c15ULL + perm_key) & perm_mask;
+        x ^= x >> 7;
+        x = (x * 0xbf58476d1ce4e5b9ULL) & perm_mask;
+        x ^= (x >> 11) ^ (x >> 3);
+        x &= perm_mask;
+    } while (x >= n);
+    return x;
+}
+
+/* Per-pattern state */
+static uint64_t seq_pos, stride_pos, stride_lane, chase_step;
+static uint64_t tile_side, tile_i, tile_j, tile_k, tile_l;
+static int tile_store;
+static double zipf_a, zipf_b;
+
+/*
+ * nextTiles - One access of a blocked transpose of a square int matrix A
+ *     into B, both inside the working set: a row of a tile of A is read,
+ *     then written to a column of B.
+ */
+static uint64_t nextTiles(char *op)
+{
+    uint64_t addr;
+    uint64_t h = (tile_side - tile_i < tile) ? tile_side - tile_i : tile;
+    uint64_t w = (tile_side - tile_j < tile) ? tile_side - tile_j : tile;
+
+    if (!tile_store) {
+        *op = 'L';
+        addr = base + 4 * ((tile_i + tile_k) * tile_side + tile_j + tile_l);
+    }
+    else {
+        *op = 'S';
+        addr = base + 4 * (tile_side * tile_side
+                           + (tile_j + tile_l) * tile_side + tile_i + tile_k);
+    }
+
+    /* Advance: loads of one row, then its stores, row by row, tile by tile */
+    if (++tile_l < w)
+        return addr;
+    tile_l = 0;
+    if ((tile_store = !tile_store))
+        return addr;
+    if (++tile_k < h)
+        return addr;
+    tile_k = 0;
+    if ((tile_j += tile) < tile_side)
+        return addr;
+    tile_j = 0;
+    if ((tile_i += tile) >= tile_side)
+        tile_i = 0;
+    return addr;
+}
+
+/*
+ * nextAccess - Address (and for tiles, operation) of the next access
+ *     from pattern p
+ */
+static inline uint64_t nextAccess(enum pattern p, char *op)
+{
+    uint64_t nblocks = wset / LINE;
+    uint64_t rank;
+
+    switch (p) {
+    case SEQ:
+        seq_pos += elem;
+        if (seq_pos >= wset)
+            seq_pos = 0;
+        return base + seq_pos;
+    case STRIDE:
+        stride_pos += stride;
+        if (stride_pos >= wset) {
+            stride_lane = (stride_lane + elem) % stride;
+            stride_pos = stride_lane;
+        }
+        return base + stride_pos;
+    case UNIFORM:
+        return base + below(wset / elem) * elem;
+    case ZIPF:
+        /* Inverse CDF of a power law on [1, nblocks + 1), floored to a rank */
+        if (alpha == 1.0)
+            rank = (uint64_t) exp(unit() * zipf_a) - 1;
+        else
+            rank = (uint64_t) pow(unit() * zipf_a + 1.0, zipf_b) - 1;
+        if (rank >= nblocks)
+            rank = nblocks - 1;
+        return base + permute(rank, nblocks) * LINE + below(LINE / elem) * elem;
+    case CHASE:
+        if (++chase_step >= nblocks)
+            chase_step = 0;
+        return base + permute(chase_step, nblocks) * LINE;
+    case TILES:
+        return nextTiles(op);
+    default:
+        return base;
+    }
+}
+
+/*
+ * putHex - Append x in lower-case hex without leading zeros
+ */
+static inline char *putHex(char *p, uint64_t x)
+{
+    char digits[16];
+    int n = 0;
+
+    do {
+        digits[n++] = "0123456789abcdef"[x & 0xf];
+        x >>= 4;
+    } while (x);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+/*
+ * parsePatterns - Parse "name[:weight],..." into the weights array
+ */
+static int parsePatterns(char *arg)
+{
+    char *tok, *colon;
+    int p, total = 0;
+
+    memset(weights, 0, sizeof(weights));
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        colon = strchr(tok, ':');
+        if (colon)
+            *colon = '\0';
+        for (p = 0; p < NPATTERNS; p++)
+            if (strcmp(tok, pattern_names[p]) == 0)
+                break;
+        if (p == NPATTERNS)
+            return 0;
+        weights[p] = colon ? atoi(colon + 1) : 1;
+        if (weights[p] < 0)
+            return 0;
+        total += weights[p];
+    }
+    return total > 0;
+}
+
+/*
+ * parseCount - Parse a number with an optional k/M/G (powers of 1000)
+ *     or K/Mi/Gi style binary suffix
+ */
+static uint64_t parseCount(const char *arg)
+{
+    char *end;
+    uint64_t n = strtoull(arg, &end, 0);
+
+    switch (*end) {
+    case 'k': return n * 1000ULL;
+    case 'K': return n << 10;
+    case 'M': return (end[1] == 'i') ? n << 20 : n * 1000000ULL;
+    case 'G': return (end[1] == 'i') ? n << 30 : n * 1000000000ULL;
+    default: return n;
+    }
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[])
+{
+    printf("Usage: %s [-h] [-n <count>] [-p <patterns>] [-f text|bin] [-o <file>] [options]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h              Print this help message.\n");
+    printf("  -n <count>      Number of accesses, k/M/G suffixes allowed (default 1M)\n");
+    printf("  -p <patterns>   Comma list of pattern[:weight] from seq, stride, uniform,\n");
+    printf("                  zipf, chase, tiles (default seq)\n");
+    printf("  -f text|bin     Output format (default text)\n");
+    printf("  -o <file>       Output file (default stdout)\n");
+    printf("  -s <seed>       RNG seed (default 1)\n");
+    printf("  -w <bytes>      Working set size, Ki/Mi/Gi suffixes allowed (default 16Mi)\n");
+    printf("  -a <addr>       Base address (default 0x10000000)\n");
+    printf("  -e <bytes>      Access size (default 4)\n");
+    printf("  -S <bytes>      Stride of the stride pattern (default 256)\n");
+    printf("  -z <alpha>      Zipf exponent (default 1.0)\n");
+    printf("  -t <side>       Tile side of the tiles pattern (default 8)\n");
+    printf("  -m <L,S,M>      Percentages of loads, stores and modifies (default 70,25,5)\n");
+    printf("Example: %s -n 1G -p zipf:3,seq,chase -f bin -o big.bin\n", argv[0]);
+}
+
+/*
+ * main - Main routine
+ */
+int main(int argc, char* argv[])
+{
+    char c, op;
+    int p, total;
+    uint64_t i, addr, r;
+    FILE *out = stdout;
+    char *outname = NULL;
+    char pattern_arg[256] = "seq";
+    enum pattern current = SEQ;
+    int table[100];
+
+    while ((c = getopt(argc, argv, "n:p:f:o:s:w:a:e:S:z:t:m:h")) != -1) {
+        switch(c) {
+        case 'n':
+            count = parseCount(optarg);
+            break;
+        case 'p':
+            snprintf(pattern_arg, sizeof(pattern_arg), "%s", optarg);
+            break;
+        case 'f':
+            binary = (strcmp(optarg, "bin") == 0);
+            if (!binary && strcmp(optarg, "text") != 0) {
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            wset = parseCount(optarg);
+            break;
+        case 'a':
+            base = strtoull(optarg, NULL, 0);
+            break;
+        case 'e':
+            elem = atoi(optarg);
+            break;
+        case 'S':
+            stride = parseCount(optarg);
+            break;
+        case 'z':
+            alpha = atof(optarg);
+            break;
+        case 't':
+            tile = atoi(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d,%d,%d", &pct_load, &pct_store, &pct_modify) != 3) {
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (!parsePatterns(pattern_arg)) {
+        printf("Error: bad pattern list \"%s\"\n", pattern_arg);
+        exit(1);
+    }
+    if (elem < 1 || elem > TRACE_BIN_MAX_SIZE || wset < LINE || stride < (uint64_t) elem ||
+        tile < 1 || alpha <= 0 || pct_load < 0 || pct_store < 0 || pct_modify < 0 ||
+        pct_load + pct_store + pct_modify != 100 || base + 2 * wset > TRACE_BIN_ADDR_MASK) {
+        printf("Error: invalid option values\n");
+        usage(argv);
+        exit(1);
+    }
+    if (outname && (out = fopen(outname, "w")) == NULL) {
+        perror(outname);
+        exit(1);
+    }
+
+    seedRng(seed);
+
+    /* Pattern chosen by each percentile when patterns are mixed */
+    total = 0;
+    for (p = 0; p < NPATTERNS; p++)
+        total += weights[p];
+    {
+        int acc = 0, q = 0;
+        for (p = 0; p < NPATTERNS; p++) {
+            acc += weights[p];
+            while (q < 100 && q * total < acc * 100)
+                table[q++] = p;
+        }
+    }
+
+    /* Pattern parameters */
+    for (perm_mask = 1; perm_mask < wset / LINE; perm_mask <<= 1)
+        ;
+    perm_mask -= 1;
+    perm_key = next();
+    if (alpha == 1.0)
+        zipf_a = log((double) (wset / LINE) + 1.0);
+    else {
+        zipf_a = pow((double) (wset / LINE) + 1.0, 1.0 - alpha) - 1.0;
+        zipf_b = 1.0 / (1.0 - alpha);
+    }
+    for (tile_side = 1; 8 * (tile_side + 1) * (tile_side + 1) <= wset; tile_side++)
+        ;
+    seq_pos = wset - elem;
+    stride_pos = wset;
+    stride_lane = stride - elem;
+    chase_step = wset / LINE - 1;
+
+    char *buf = malloc(OUTBUF + 64);
+    char *pos = buf;
+    if (buf == NULL) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    if (binary) {
+        memcpy(pos, TRACE_BIN_MAGIC, TRACE_BIN_MAGIC_LEN);
+        pos += TRACE_BIN_MAGIC_LEN;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (i % BURST == 0)
+            current = table[below(100)];
+
+        r = below(100);
+        op = (r < pct_load) ? 'L' : (r < pct_load + pct_store) ? 'S' : 'M';
+        addr = nextAccess(current, &op);
+
+        if (binary) {
+            uint64_t rec = TRACE_BIN_RECORD(strchr(TRACE_BIN_OPS, op) - TRACE_BIN_OPS, addr, elem);
+            memcpy(pos, &rec, sizeof(rec));
+            pos += sizeof(rec);
+        }
+        else {
+            *pos++ = ' ';
+            *pos++ = op;
+            *pos++ = ' ';
+            pos = putHex(pos, addr);
+            *pos++ = ',';
+            if (elem >= 10)
+                *pos++ = '0' + elem / 10;
+            *pos++ = '0' + elem % 10;
+            *pos++ = '\n';
+        }
+
+        if (pos - buf >= OUTBUF) {
+            if (fwrite(buf, 1, pos - buf, out) != (size_t) (pos - buf)) {
+                perror("write");
+                exit(1);
+            }
+            pos = buf;
+        }
+    }
+    if (fwrite(buf, 1, pos - buf, out) != (size_t) (pos - buf)) {
+        perror("write");
+        exit(1);
+    }
+
+    free(buf);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
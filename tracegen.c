@@ -4,7 +4,9 @@
  * 
  * The beginning and end of each registered transpose function's trace
  * is indicated by reading from "marker" addresses. These two marker
- * addresses are recorded in file for later use.
+ * addresses are recorded in file for later use, followed by a second
+ * line with the base addresses of A and B and the matrix size, which
+ * "csim -L" uses to map misses back to matrix elements.
  */
 
 #include <stdlib.h>
@@ -18,6 +20,8 @@
 /* External variables declared in cachelab.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
 extern int func_counter; 
+extern inplace_func_t inplace_list[MAX_TRANS_FUNCS];
+extern int inplace_counter;
 
 /* External function from trans.c */
 extern void registerFunctions();
@@ -27,6 +31,7 @@ volatile char MARKER_START, MARKER_END;
 
 static int A[256][256];
 static int B[256][256];
+static int C[256][256]; /* copy of A for checking in-place functions */
 static int M;
 static int N;
 
@@ -46,12 +51,48 @@ int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
     return 1;
 }
 
+int validateInplace(int fn, int N, int orig[N][N], int A[N][N]) {
+    for(int i=0;i<N;i++) {
+        for(int j=0;j<N;j++) {
+            if(A[i][j]!=orig[j][i]) {
+                printf("Validation failed on in-place function %d! Expected %d but got %d at A[%d][%d]\n",fn,orig[j][i],A[i][j],i,j);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * runInplace - Trace the selected in-place functions (all if -1) on A,
+ *     which must be square. Returns 0, or the failing function plus one.
+ */
+int runInplace(int selectedFunc) {
+    int i;
+    if (M != N) {
+        printf("In-place functions need a square matrix, got %dx%d\n", M, N);
+        return 1;
+    }
+    for (i=0; i < inplace_counter; i++) {
+        if (selectedFunc != -1 && selectedFunc != i)
+            continue;
+        memcpy(C, A, sizeof(int) * M * N);
+        MARKER_START = 33;
+        (*inplace_list[i].func_ptr)(N, A);
+        MARKER_END = 34;
+        if (!validateInplace(i,N,C,A))
+            return i+1;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]){
     int i;
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"M:N:F:")) != -1){
+    int inplace=0;
+    while( (c=getopt(argc,argv,"M:N:F:I")) != -1){
         switch(c){
         case 'M':
             M = atoi(optarg);
@@ -62,6 +103,9 @@ int main(int argc, char* argv[]){
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 'I':
+            inplace = 1; /* -F selects from the in-place functions */
+            break;
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
@@ -73,18 +117,31 @@ int main(int argc, char* argv[]){
     /*  Register transpose functions */
     registerFunctions();
 
+    /* A mistyped -F must not look like a passing run */
+    if (selectedFunc != -1 &&
+        (selectedFunc < 0 || selectedFunc >= (inplace ? inplace_counter : func_counter))) {
+        printf("Error: no %sfunction %d, there are %d\n", inplace ? "in-place " : "",
+               selectedFunc, inplace ? inplace_counter : func_counter);
+        exit(1);
+    }
+
     /* Fill A with data */
     initMatrix(M,N, A, B); 
 
-    /* Record marker addresses */
+    /* Record marker addresses, then the layout of A and B */
     FILE* marker_fp = fopen(".marker","w");
     assert(marker_fp);
-    fprintf(marker_fp, "%llx %llx", 
+    fprintf(marker_fp, "%llx %llx\n", 
             (unsigned long long int) &MARKER_START,
             (unsigned long long int) &MARKER_END );
+    fprintf(marker_fp, "%llx %llx %d %d\n",
+            (unsigned long long int) A,
+            (unsigned long long int) B, M, N);
     fclose(marker_fp);
 
-    if (-1==selectedFunc) {
+    if (inplace) {
+        return runInplace(selectedFunc);
+    } else if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
             MARKER_START = 33;
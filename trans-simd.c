@@ -0,0 +1,229 @@
+/*
+ * trans-simd.c - Register-tile transposes for native wall-clock speed
+ *
+ * The kernels in trans.c are tuned for the simulated-miss metric and
+ * move every element through a scalar local. These transpose whole
+ * tiles inside vector registers instead: 4x4 int tiles with SSE2
+ * unpacks, and 8x8 tiles with AVX2 unpacks plus a 128-bit lane
+ * permute. Ragged edges are finished with scalar code so any MxN works.
+ *
+ * initStrided() picks the widest kernel the CPU supports through CPUID,
+ * falling back to scalar code elsewhere; transStrided() calls it on first
+ * use, and ptransCreate() before any worker thread exists. The kernels
+ * work on strided blocks, so ptrans.c can hand them tiles of larger
+ * matrices.
+ */
+#include <stdio.h>
+#include "cachelab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * stridedScalar - Scalar transpose of a rows x cols block of A (row stride
+ *     lda) into B (row stride ldb); finishes ragged edges of the vector
+ *     kernels and stands in for them where SIMD is unavailable
+ */
+static void stridedScalar(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb)
+{
+    int i, j;
+
+    for (i = 0; i < rows; i++)
+        for (j = 0; j < cols; j++)
+            B[j * ldb + i] = A[i * lda + j];
+}
+
+/*
+ * stridedEdges - Transpose what a tile kernel left over: the rows below
+ *     i0, and the columns right of j0 in the rows above it
+ */
+static void stridedEdges(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb,
+                         int i0, int j0)
+{
+    stridedScalar(i0, cols - j0, A + j0, lda, B + j0 * ldb, ldb);
+    stridedScalar(rows - i0, cols, A + i0 * lda, lda, B + i0, ldb);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * tile4SSE2 - Transpose one 4x4 tile in four XMM registers
+ */
+static inline void tile4SSE2(const int *a, size_t lda, int *b, size_t ldb)
+{
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+    r0 = _mm_loadu_si128((__m128i *) (a + 0 * lda));
+    r1 = _mm_loadu_si128((__m128i *) (a + 1 * lda));
+    r2 = _mm_loadu_si128((__m128i *) (a + 2 * lda));
+    r3 = _mm_loadu_si128((__m128i *) (a + 3 * lda));
+
+    t0 = _mm_unpacklo_epi32(r0, r1);   /* a0 b0 a1 b1 */
+    t1 = _mm_unpacklo_epi32(r2, r3);   /* c0 d0 c1 d1 */
+    t2 = _mm_unpackhi_epi32(r0, r1);   /* a2 b2 a3 b3 */
+    t3 = _mm_unpackhi_epi32(r2, r3);   /* c2 d2 c3 d3 */
+
+    _mm_storeu_si128((__m128i *) (b + 0 * ldb), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *) (b + 1 * ldb), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *) (b + 2 * ldb), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *) (b + 3 * ldb), _mm_unpackhi_epi64(t2, t3));
+}
+
+/*
+ * tile8AVX2 - Transpose one 8x8 tile in eight YMM registers: two rounds
+ *     of unpacks transpose the 4x4 quarters within each 128-bit lane, and
+ *     a lane permute swaps the off-diagonal quarters.
+ */
+__attribute__((target("avx2")))
+static inline void tile8AVX2(const int *a, size_t lda, int *b, size_t ldb)
+{
+    __m256i r0, r1, r2, r3, r4, r5, r6, r7;
+    __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+
+    r0 = _mm256_loadu_si256((__m256i *) (a + 0 * lda));
+    r1 = _mm256_loadu_si256((__m256i *) (a + 1 * lda));
+    r2 = _mm256_loadu_si256((__m256i *) (a + 2 * lda));
+    r3 = _mm256_loadu_si256((__m256i *) (a + 3 * lda));
+    r4 = _mm256_loadu_si256((__m256i *) (a + 4 * lda));
+    r5 = _mm256_loadu_si256((__m256i *) (a + 5 * lda));
+    r6 = _mm256_loadu_si256((__m256i *) (a + 6 * lda));
+    r7 = _mm256_loadu_si256((__m256i *) (a + 7 * lda));
+
+    t0 = _mm256_unpacklo_epi32(r0, r1);
+    t1 = _mm256_unpackhi_epi32(r0, r1);
+    t2 = _mm256_unpacklo_epi32(r2, r3);
+    t3 = _mm256_unpackhi_epi32(r2, r3);
+    t4 = _mm256_unpacklo_epi32(r4, r5);
+    t5 = _mm256_unpackhi_epi32(r4, r5);
+    t6 = _mm256_unpacklo_epi32(r6, r7);
+    t7 = _mm256_unpackhi_epi32(r6, r7);
+
+    r0 = _mm256_unpacklo_epi64(t0, t2);
+    r1 = _mm256_unpackhi_epi64(t0, t2);
+    r2 = _mm256_unpacklo_epi64(t1, t3);
+    r3 = _mm256_unpackhi_epi64(t1, t3);
+    r4 = _mm256_unpacklo_epi64(t4, t6);
+    r5 = _mm256_unpackhi_epi64(t4, t6);
+    r6 = _mm256_unpacklo_epi64(t5, t7);
+    r7 = _mm256_unpackhi_epi64(t5, t7);
+
+    _mm256_storeu_si256((__m256i *) (b + 0 * ldb), _mm256_permute2x128_si256(r0, r4, 0x20));
+    _mm256_storeu_si256((__m256i *) (b + 1 * ldb), _mm256_permute2x128_si256(r1, r5, 0x20));
+    _mm256_storeu_si256((__m256i *) (b + 2 * ldb), _mm256_permute2x128_si256(r2, r6, 0x20));
+    _mm256_storeu_si256((__m256i *) (b + 3 * ldb), _mm256_permute2x128_si256(r3, r7, 0x20));
+    _mm256_storeu_si256((__m256i *) (b + 4 * ldb), _mm256_permute2x128_si256(r0, r4, 0x31));
+    _mm256_storeu_si256((__m256i *) (b + 5 * ldb), _mm256_permute2x128_si256(r1, r5, 0x31));
+    _mm256_storeu_si256((__m256i *) (b + 6 * ldb), _mm256_permute2x128_si256(r2, r6, 0x31));
+    _mm256_storeu_si256((__m256i *) (b + 7 * ldb), _mm256_permute2x128_si256(r3, r7, 0x31));
+}
+
+/*
+ * stridedSSE2 - Transpose a strided block with 4x4 tiles
+ */
+static void stridedSSE2(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb)
+{
+    int i, j;
+
+    for (i = 0; i + 4 <= rows; i += 4)
+        for (j = 0; j + 4 <= cols; j += 4)
+            tile4SSE2(A + i * lda + j, lda, B + j * ldb + i, ldb);
+    stridedEdges(rows, cols, A, lda, B, ldb, rows - rows % 4, cols - cols % 4);
+}
+
+/*
+ * stridedAVX2 - Transpose a strided block with 8x8 tiles
+ */
+__attribute__((target("avx2")))
+static void stridedAVX2(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb)
+{
+    int i, j;
+
+    for (i = 0; i + 8 <= rows; i += 8)
+        for (j = 0; j + 8 <= cols; j += 8)
+            tile8AVX2(A + i * lda + j, lda, B + j * ldb + i, ldb);
+    stridedEdges(rows, cols, A, lda, B, ldb, rows - rows % 8, cols - cols % 8);
+}
+
+/*
+ * trans_sse2 - 4x4 tiles, each transposed in four XMM registers
+ */
+char trans_sse2_desc[] = "SSE2 4x4 register-tile transpose";
+void trans_sse2(int M, int N, int A[N][M], int B[M][N])
+{
+    stridedSSE2(N, M, &A[0][0], M, &B[0][0], N);
+}
+
+/*
+ * trans_avx2 - 8x8 tiles, each transposed in eight YMM registers
+ */
+char trans_avx2_desc[] = "AVX2 8x8 register-tile transpose";
+void trans_avx2(int M, int N, int A[N][M], int B[M][N])
+{
+    stridedAVX2(N, M, &A[0][0], M, &B[0][0], N);
+}
+#endif
+
+/* Strided kernel chosen by CPUID, read and set atomically */
+typedef void (*strided_fn)(int, int, const int *, size_t, int *, size_t);
+static strided_fn strided_kernel = NULL;
+
+/*
+ * initStrided - Pick the widest strided kernel this CPU supports. Multithreaded
+ *     callers run it before starting their threads, so the CPUID probe
+ *     never races; single-threaded callers can leave it to transStrided().
+ */
+void initStrided()
+{
+    strided_fn kernel = stridedScalar;
+
+    if (__atomic_load_n(&strided_kernel, __ATOMIC_ACQUIRE) != NULL)
+        return;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = stridedAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        kernel = stridedSSE2;
+#endif
+    __atomic_store_n(&strided_kernel, kernel, __ATOMIC_RELEASE);
+}
+
+/*
+ * transStrided - Transpose the rows x cols block at A (row stride lda)
+ *     into B (row stride ldb) with the widest kernel this CPU supports.
+ *     Lets callers work on tiles of matrices larger than one kernel call.
+ */
+void transStrided(int rows, int cols, const int *A, size_t lda, int *B, size_t ldb)
+{
+    strided_fn kernel = __atomic_load_n(&strided_kernel, __ATOMIC_ACQUIRE);
+
+    if (kernel == NULL) {
+        initStrided();
+        kernel = __atomic_load_n(&strided_kernel, __ATOMIC_ACQUIRE);
+    }
+    (*kernel)(rows, cols, A, lda, B, ldb);
+}
+
+/*
+ * trans_simd - Runtime dispatch between the AVX2, SSE2 and scalar kernels
+ */
+char trans_simd_desc[] = "SIMD register-tile transpose (CPUID dispatch)";
+void trans_simd(int M, int N, int A[N][M], int B[M][N])
+{
+    transStrided(N, M, &A[0][0], M, &B[0][0], N);
+}
+
+/*
+ * registerSimdFunctions - Register the vector kernels this CPU can run
+ */
+void registerSimdFunctions()
+{
+    registerTransFunction(trans_simd, trans_simd_desc);
+#ifdef HAVE_X86_SIMD
+    registerTransFunction(trans_sse2, trans_sse2_desc);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        registerTransFunction(trans_avx2, trans_avx2_desc);
+#endif
+}
@@ -0,0 +1,255 @@
+/*
+ * tune-trans.c - Autotuner for the blocked transpose in trans.c.
+ *
+ * Every member of the trans_blocked() family (tile width and height,
+ * diagonal deferral, and the 64x64 quadrant swap) is run on the same
+ * static matrices tracegen uses, with its matrix accesses recorded
+ * through the TRANS_LOAD/TRANS_STORE hooks instead of valgrind. Each
+ * trace is scored by the reference simulator on the requested cache,
+ * and the winner is printed as a TUNED() row for lookupConfig() in trans.c.
+ * A sweep takes well under a second, so it can be rerun for each cache
+ * geometry we deploy on. Traces and simulator results are written to a
+ * private tune-trans.XXXXXX directory, so tuners can run side by side
+ * and next to test-trans.
+ */
+#define _POSIX_C_SOURCE 200809L /* for getcwd and chdir */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include "cachelab.h"
+
+/* Maximum array dimension */
+#define MAXN 256
+
+/* Description of the parameterized kernel registered by trans.c */
+#define BLOCKED_DESCRIPTION "Tuned blocked transpose"
+
+/* File the trace of the current variant is written to, in scratch_dir */
+#define TRACE_FILE "trace.tune"
+
+/* Directory tune-trans was started in, where csim-ref lives, quoted for
+   the shell, and the private scratch directory the sweep runs in */
+static char topdir[PATH_MAX];
+static char quoted_topdir[4 * PATH_MAX + 3];
+static char scratch_dir[32] = "";
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+/* External functions and variables defined in trans.c */
+extern void registerFunctions();
+extern int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+extern trans_config_t *trans_override;
+
+/* Same storage as tracegen, so the A/B alignment matches test-trans */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
+/* Globals set on the command line */
+static int M = 0;
+static int N = 0;
+static int verbose = 0;
+
+/* Trace file for the variant being recorded */
+static FILE *trace_fp = NULL;
+
+/* Tile sizes swept for both the width and the height */
+static const int tile_sizes[] = {2, 4, 6, 8, 12, 16, 20, 24, 32};
+
+/*
+ * traceAccess - Called by trans_blocked() for every matrix access; writes
+ *     it in the same format valgrind's lackey tool produces.
+ */
+void traceAccess(char op, void *addr, int size)
+{
+    if (trace_fp)
+        fprintf(trace_fp, " %c %llx,%d\n", op,
+                (unsigned long long int) addr, size);
+}
+
+/*
+ * removeScratch - Delete the scratch directory and the files in it; runs
+ *     at exit, so error exits clean up too
+ */
+static void removeScratch()
+{
+    if (scratch_dir[0] == '\0' || chdir(topdir) != 0)
+        return;
+    removeDir(scratch_dir);
+    scratch_dir[0] = '\0';
+}
+
+/*
+ * evalConfig - Run one variant, check it, and return its simulated misses
+ *     (INT_MAX if the variant is not a correct transpose)
+ */
+int evalConfig(trans_func_t *kernel, trans_config_t *config,
+               unsigned int s, unsigned int E, unsigned int b)
+{
+    unsigned int hits, misses, evictions;
+    char cmd[sizeof(quoted_topdir) + 255];
+
+    initMatrix(M, N, A, B);
+
+    trace_fp = fopen(TRACE_FILE, "w");
+    assert(trace_fp);
+    trans_override = config;
+    (*kernel->func_ptr)(M, N, A, B);
+    trans_override = NULL;
+    fclose(trace_fp);
+    trace_fp = NULL;
+
+    if (!is_transpose(M, N, A, B))
+        return INT_MAX;
+
+    /* Run the reference simulator */
+    sprintf(cmd, "%s/csim-ref -s %u -E %u -b %u -t %s > /dev/null",
+            quoted_topdir, s, E, b, TRACE_FILE);
+    if (system(cmd) != 0) {
+        printf("Error: %s failed\n", cmd);
+        exit(1);
+    }
+
+    /* Collect results from the reference simulator */
+    FILE* in_fp = fopen(".csim_results", "r");
+    assert(in_fp);
+    if (fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions) != 3)
+        misses = INT_MAX;
+    fclose(in_fp);
+    return misses;
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[])
+{
+    printf("Usage: %s [-hv] -M <cols> -N <rows> [-s <s> -E <E> -b <b>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -v          Print the score of every variant.\n");
+    printf("  -M <cols>   Number of matrix columns (max %d)\n", MAXN);
+    printf("  -N <rows>   Number of matrix rows (max %d)\n", MAXN);
+    printf("  -s <s>      Number of set index bits (default 5)\n");
+    printf("  -E <E>      Associativity (default 1)\n");
+    printf("  -b <b>      Number of block bits (default 5)\n");
+    printf("Example: %s -M 64 -N 64 -s 5 -E 1 -b 5\n", argv[0]);
+}
+
+/*
+ * main - Main routine
+ */
+int main(int argc, char* argv[])
+{
+    char c;
+    unsigned int s = 5, E = 1, b = 5;
+    int i, w, h, defer, swap, misses, variants = 0;
+    int best_misses = INT_MAX;
+    trans_config_t config, best;
+    trans_func_t *kernel = NULL;
+
+    while ((c = getopt(argc, argv, "M:N:s:E:b:hv")) != -1) {
+        switch(c) {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (M <= 0 || N <= 0 || M > MAXN || N > MAXN || E == 0) {
+        printf("Error: M and N must be in 1..%d and E at least 1\n", MAXN);
+        usage(argv);
+        exit(1);
+    }
+
+    /* Run the sweep in a private scratch directory */
+    if (getcwd(topdir, sizeof(topdir)) == NULL) {
+        perror("getcwd");
+        exit(1);
+    }
+    quotePath(quoted_topdir, topdir);
+    makeScratchDir(scratch_dir, "tune-trans");
+    atexit(removeScratch);
+    if (chdir(scratch_dir) != 0) {
+        perror("chdir");
+        exit(1);
+    }
+
+    /* Find the parameterized kernel among the registered functions */
+    registerFunctions();
+    for (i = 0; i < func_counter; i++) {
+        if (strcmp(func_list[i].description, BLOCKED_DESCRIPTION) == 0)
+            kernel = &func_list[i];
+    }
+    if (kernel == NULL) {
+        printf("Error: no function registered as \"%s\"\n", BLOCKED_DESCRIPTION);
+        exit(1);
+    }
+
+    /* Sweep the family; swap64 only applies to 8x8 and deferral to square tiles */
+    int nsizes = sizeof(tile_sizes) / sizeof(tile_sizes[0]);
+    for (w = 0; w < nsizes; w++) {
+        for (h = 0; h < nsizes; h++) {
+            for (defer = 0; defer <= 1; defer++) {
+                for (swap = 0; swap <= 1; swap++) {
+                    config.bw = tile_sizes[w];
+                    config.bh = tile_sizes[h];
+                    config.defer_diag = defer;
+                    config.swap64 = swap;
+                    if (defer && config.bw != config.bh)
+                        continue;
+                    if (swap && (config.bw != 8 || config.bh != 8))
+                        continue;
+
+                    misses = evalConfig(kernel, &config, s, E, b);
+                    variants++;
+                    if (verbose)
+                        printf("bw=%-2d bh=%-2d defer=%d swap64=%d: misses:%d\n",
+                               config.bw, config.bh, defer, swap, misses);
+                    if (misses < best_misses) {
+                        best_misses = misses;
+                        best = config;
+                    }
+                }
+            }
+        }
+    }
+    removeScratch();
+
+    if (best_misses == INT_MAX) {
+        printf("Error: no variant produced a correct transpose\n");
+        exit(1);
+    }
+
+    printf("%dx%d on (s=%u, E=%u, b=%u): best of %d variants has %d misses\n",
+           M, N, s, E, b, variants, best_misses);
+    printf("\tTUNED( %d, %d, %u, %u, %u, %d, %d, %d, %d );\n",
+           M, N, s, E, b, best.bw, best.bh, best.defer_diag, best.swap64);
+    return 0;
+}